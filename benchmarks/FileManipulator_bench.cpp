@@ -0,0 +1,307 @@
+// the benchmarks reach into the internals of the library
+#include "filemanipulator_internal.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace filemanipulator;
+
+/**
+ * =============================================================================
+ * Inputs
+ * =============================================================================
+ */
+
+/**
+ * Builds a tab separated line of fields fields, each of width random letters
+ * @param fields
+ * @param width
+ * @param seed
+ */
+std::string make_line(int fields, int width, unsigned seed = 42) {
+  std::mt19937 random(seed);
+  std::uniform_int_distribution<int> letter(0, 51);
+  std::string line;
+  for (int field = 0; field < fields; ++field) {
+    if (field != 0) {
+      line.push_back('\t');
+    }
+    for (int idx = 0; idx < width; ++idx) {
+      int c = letter(random);
+      line.push_back(static_cast<char>(c < 26 ? 'a' + c : 'A' + c - 26));
+    }
+  }
+  return line;
+}
+
+/**
+ * Builds about size bytes of lines with fields fields of width letters
+ */
+std::string make_input(size_t size, int fields, int width) {
+  std::string input;
+  unsigned seed = 0;
+  while (input.size() < size) {
+    input += make_line(fields, width, seed++ % 64);
+    input.push_back('\n');
+  }
+  return input;
+}
+
+/**
+ * Sink that only counts what would be written
+ */
+class CountingSink {
+ public:
+  void write(std::string_view bytes) { bytes_ += bytes.size(); }
+  void put(char) { ++bytes_; }
+  void end_line() { ++bytes_; ++lines_; }
+  size_t bytes() const { return bytes_; }
+  size_t lines() const { return lines_; }
+ private:
+  size_t bytes_ = 0;
+  size_t lines_ = 0;
+};
+
+ExecutionPlan make_plan(std::vector<std::unique_ptr<Command>> commands) {
+  return ExecutionPlan(std::move(commands));
+}
+
+/**
+ * =============================================================================
+ * Tokenizer
+ * =============================================================================
+ */
+
+// args: fields per line, field width
+void BM_Tokenize(benchmark::State& state) {
+  std::string line = make_line(state.range(0), state.range(1));
+  std::vector<std::string_view> fields;
+  for (auto _ : state) {
+    fields.clear();
+    tokenize(line, '\t', fields);
+    benchmark::DoNotOptimize(fields.data());
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * line.size());
+}
+BENCHMARK(BM_Tokenize)->ArgsProduct({{4, 16, 64}, {4, 16, 128}});
+
+// args: fields per line, field width; only the first field is split off
+void BM_TokenizeFirstField(benchmark::State& state) {
+  std::string line = make_line(state.range(0), state.range(1));
+  std::vector<std::string_view> fields;
+  for (auto _ : state) {
+    fields.clear();
+    benchmark::DoNotOptimize(tokenize(line, '\t', fields, 1));
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * line.size());
+}
+BENCHMARK(BM_TokenizeFirstField)->ArgsProduct({{16, 64}, {16, 128}});
+
+void BM_FrameLines(benchmark::State& state) {
+  std::string input = make_input(state.range(0), 8, 16);
+  for (auto _ : state) {
+    size_t lines = 0;
+    for_each_line(input, [&lines](std::string_view) { ++lines; });
+    benchmark::DoNotOptimize(lines);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * input.size());
+}
+BENCHMARK(BM_FrameLines)->Arg(1 << 20);
+
+/**
+ * =============================================================================
+ * Commands
+ * =============================================================================
+ */
+
+template <typename MakeCommand>
+void run_command(benchmark::State& state, MakeCommand make_command) {
+  std::unique_ptr<Command> command = make_command();
+  std::string line = make_line(1, state.range(0));
+  std::pmr::string field(line.begin(), line.end());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(command->apply(field));
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * field.size());
+}
+
+// args: field width
+void BM_LowerCaseCommand(benchmark::State& state) {
+  run_command(state, [] { return std::make_unique<LowerCaseCommand>(0); });
+}
+BENCHMARK(BM_LowerCaseCommand)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+void BM_UpperCaseCommand(benchmark::State& state) {
+  run_command(state, [] { return std::make_unique<UpperCaseCommand>(0); });
+}
+BENCHMARK(BM_UpperCaseCommand)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+void BM_ReplaceCommand(benchmark::State& state) {
+  run_command(state, [] { return std::make_unique<ReplaceCommand>(0, 'a', 'b'); });
+}
+BENCHMARK(BM_ReplaceCommand)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+void BM_ReplacePairsCommand(benchmark::State& state) {
+  run_command(state, [] {
+    return std::make_unique<ReplaceCommand>(0, std::vector<std::pair<char, char>>{{'a', 'b'}, {'b', 'a'}, {'X', 'Y'}});
+  });
+}
+BENCHMARK(BM_ReplacePairsCommand)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+// u, R and U on one field, fused into a single table
+void BM_FusedByteMap(benchmark::State& state) {
+  std::vector<std::unique_ptr<Command>> commands;
+  commands.push_back(std::make_unique<LowerCaseCommand>(0));
+  commands.push_back(std::make_unique<ReplaceCommand>(0, 'a', '_'));
+  commands.push_back(std::make_unique<UpperCaseCommand>(0));
+  ExecutionPlan plan = make_plan(std::move(commands));
+  const ByteMap* map = plan.steps().front().ops.front().map;
+  std::string field = make_line(1, state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map->apply(&field[0], field.size()));
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * field.size());
+}
+BENCHMARK(BM_FusedByteMap)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+/**
+ * =============================================================================
+ * Lines
+ * =============================================================================
+ */
+
+// args: fields per line, field width; commands on fields 0 and 2
+void BM_ApplyCommands(benchmark::State& state) {
+  std::vector<std::unique_ptr<Command>> commands;
+  commands.push_back(std::make_unique<UpperCaseCommand>(0));
+  commands.push_back(std::make_unique<ReplaceCommand>(2, 'a', 'b'));
+  ExecutionPlan plan = make_plan(std::move(commands));
+  std::string line = make_line(state.range(0), state.range(1));
+  LineScratch scratch;
+  for (auto _ : state) {
+    bool changed = false;
+    apply_commands(line, plan, changed, scratch);
+    benchmark::DoNotOptimize(changed);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * line.size());
+}
+BENCHMARK(BM_ApplyCommands)->ArgsProduct({{4, 40, 200}, {8, 64}});
+
+/**
+ * End-to-end throughput over an in-memory input: framing, tokenizing,
+ * commands and output formatting, reported as bytes/s and lines/s
+ */
+// args: fields per line, field width
+void BM_EndToEnd(benchmark::State& state) {
+  const size_t input_size = 16 << 20;
+  std::string input = make_input(input_size, state.range(0), state.range(1));
+  size_t lines = std::count(input.begin(), input.end(), '\n');
+  std::vector<std::unique_ptr<Command>> commands;
+  commands.push_back(std::make_unique<LowerCaseCommand>(0));
+  commands.push_back(std::make_unique<UpperCaseCommand>(1));
+  commands.push_back(std::make_unique<ReplaceCommand>(1, 'A', 'Z'));
+  ExecutionPlan plan = make_plan(std::move(commands));
+  LineScratch scratch;
+  for (auto _ : state) {
+    CountingSink sink;
+    process_lines(input, plan, scratch, sink);
+    benchmark::DoNotOptimize(sink.bytes());
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * input.size());
+  state.counters["lines/s"] = benchmark::Counter(double(state.iterations()) * lines, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_EndToEnd)->ArgsProduct({{4, 40}, {8, 32}})->Unit(benchmark::kMillisecond);
+
+// args: threads
+void BM_EndToEndParallel(benchmark::State& state) {
+  const size_t input_size = 64 << 20;
+  std::string input = make_input(input_size, 16, 16);
+  size_t lines = std::count(input.begin(), input.end(), '\n');
+  std::vector<std::unique_ptr<Command>> commands;
+  commands.push_back(std::make_unique<UpperCaseCommand>(3));
+  ExecutionPlan plan = make_plan(std::move(commands));
+  int null_fd = open("/dev/null", O_WRONLY);
+  for (auto _ : state) {
+    OutputWriter output(null_fd);
+    process_parallel(input, plan, state.range(0), output);
+  }
+  close(null_fd);
+  state.SetBytesProcessed(int64_t(state.iterations()) * input.size());
+  state.counters["lines/s"] = benchmark::Counter(double(state.iterations()) * lines, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_EndToEndParallel)->RangeMultiplier(2)->Range(1, 8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+/**
+ * End-to-end throughput over a file made by FileManipulator_generate, named by
+ * the FILE_MANIPULATOR_BENCH_INPUT environment variable; skipped without it
+ */
+void BM_EndToEndFile(benchmark::State& state) {
+  const char* path = std::getenv("FILE_MANIPULATOR_BENCH_INPUT");
+  if (path == nullptr) {
+    state.SkipWithError("FILE_MANIPULATOR_BENCH_INPUT is not set");
+    return;
+  }
+  int fd = open_input(path);
+  InputBuffer input(fd);
+  if (!input.mapped()) {
+    state.SkipWithError("the input can not be mapped");
+    close(fd);
+    return;
+  }
+  std::string_view data = input.data();
+  size_t lines = std::count(data.begin(), data.end(), '\n');
+  std::vector<std::unique_ptr<Command>> commands;
+  commands.push_back(std::make_unique<LowerCaseCommand>(0));
+  commands.push_back(std::make_unique<UpperCaseCommand>(1));
+  commands.push_back(std::make_unique<ReplaceCommand>(2, ' ', '_'));
+  ExecutionPlan plan = make_plan(std::move(commands));
+  LineScratch scratch;
+  for (auto _ : state) {
+    CountingSink sink;
+    process_lines(data, plan, scratch, sink);
+    benchmark::DoNotOptimize(sink.bytes());
+  }
+  close(fd);
+  state.SetBytesProcessed(int64_t(state.iterations()) * data.size());
+  state.counters["lines/s"] = benchmark::Counter(double(state.iterations()) * lines, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_EndToEndFile)->Unit(benchmark::kMillisecond);
+
+/**
+ * Reading the FILE_MANIPULATOR_BENCH_INPUT file in blocks of lines, as the
+ * pipeline does, with read(2) or with io_uring, which copies every buffer once
+ * more into the block; skipped without it. Measures the page cache copy unless
+ * the cache is dropped between runs
+ */
+// args: 0 for read(2), 1 for io_uring
+void BM_ReadBlocks(benchmark::State& state) {
+  const char* path = std::getenv("FILE_MANIPULATOR_BENCH_INPUT");
+  if (path == nullptr) {
+    state.SkipWithError("FILE_MANIPULATOR_BENCH_INPUT is not set");
+    return;
+  }
+  size_t bytes = 0;
+  std::string block;
+  for (auto _ : state) {
+    int fd = open_input(path);
+    std::unique_ptr<ByteSource> source = open_source(fd, state.range(0) != 0);
+    BlockReader reader(*source, 4 << 20);
+    while (reader.next(block)) {
+      bytes += block.size();
+      benchmark::DoNotOptimize(block.data());
+    }
+    source.reset();
+    close(fd);
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_ReadBlocks)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
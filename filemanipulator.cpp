@@ -0,0 +1,2999 @@
+#include "filemanipulator_internal.h"
+
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <memory>
+#include <memory_resource>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <string_view>
+#include <system_error>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace filemanipulator {
+
+/**
+ * =============================================================================
+ * Case conversion
+ * =============================================================================
+ */
+
+/**
+ * Flips the case of the ASCII letters in [first, first + 26) in place and
+ * returns true when at least one byte changed: first is 'A' to make a string
+ * lower case and 'a' to make it upper case. The SSE2, AVX2 and AVX-512 variants
+ * are picked at runtime depending on the CPU, the tails are done byte by byte
+ */
+using FlipCaseFn = bool (*)(char* data, size_t size, char first);
+
+bool flip_case_scalar(char* data, size_t size, char first) {
+  bool changed = false;
+  for (size_t idx = 0; idx < size; ++idx) {
+    if (static_cast<unsigned char>(data[idx] - first) < 26) {
+      data[idx] ^= 0x20;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+bool flip_case_sse2(char* data, size_t size, char first) {
+  // shifts the letters to the bottom of the signed range for a single compare
+  const __m128i bias = _mm_set1_epi8(static_cast<char>(-128 - first));
+  const __m128i limit = _mm_set1_epi8(-128 + 26);
+  const __m128i flip = _mm_set1_epi8(0x20);
+  __m128i flipped = _mm_setzero_si128();
+  size_t idx = 0;
+  for (; idx + 16 <= size; idx += 16) {
+    __m128i* ptr = reinterpret_cast<__m128i*>(data + idx);
+    __m128i chunk = _mm_loadu_si128(ptr);
+    __m128i letters = _mm_cmplt_epi8(_mm_add_epi8(chunk, bias), limit);
+    __m128i mask = _mm_and_si128(letters, flip);
+    flipped = _mm_or_si128(flipped, mask);
+    _mm_storeu_si128(ptr, _mm_xor_si128(chunk, mask));
+  }
+  bool changed = _mm_movemask_epi8(_mm_cmpeq_epi8(flipped, _mm_setzero_si128())) != 0xFFFF;
+  return flip_case_scalar(data + idx, size - idx, first) || changed;
+}
+
+__attribute__((target("avx2")))
+bool flip_case_avx2(char* data, size_t size, char first) {
+  const __m256i bias = _mm256_set1_epi8(static_cast<char>(-128 - first));
+  const __m256i limit = _mm256_set1_epi8(-128 + 26);
+  const __m256i flip = _mm256_set1_epi8(0x20);
+  __m256i flipped = _mm256_setzero_si256();
+  size_t idx = 0;
+  for (; idx + 32 <= size; idx += 32) {
+    __m256i* ptr = reinterpret_cast<__m256i*>(data + idx);
+    __m256i chunk = _mm256_loadu_si256(ptr);
+    __m256i letters = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(chunk, bias));
+    __m256i mask = _mm256_and_si256(letters, flip);
+    flipped = _mm256_or_si256(flipped, mask);
+    _mm256_storeu_si256(ptr, _mm256_xor_si256(chunk, mask));
+  }
+  bool changed = !_mm256_testz_si256(flipped, flipped);
+  return flip_case_scalar(data + idx, size - idx, first) || changed;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+bool flip_case_avx512(char* data, size_t size, char first) {
+  const __m512i start = _mm512_set1_epi8(first);
+  const __m512i letters_count = _mm512_set1_epi8(26);
+  const __m512i flip = _mm512_set1_epi8(0x20);
+  __mmask64 flipped = 0;
+  size_t idx = 0;
+  for (; idx + 64 <= size; idx += 64) {
+    __m512i chunk = _mm512_loadu_si512(data + idx);
+    __mmask64 letters = _mm512_cmplt_epu8_mask(_mm512_sub_epi8(chunk, start), letters_count);
+    flipped |= letters;
+    _mm512_storeu_si512(data + idx, _mm512_xor_si512(chunk, _mm512_maskz_mov_epi8(letters, flip)));
+  }
+  return flip_case_scalar(data + idx, size - idx, first) || flipped != 0;
+}
+#endif
+
+FlipCaseFn select_flip_case() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw")) {
+    return flip_case_avx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return flip_case_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return flip_case_sse2;
+  }
+#endif
+  return flip_case_scalar;
+}
+
+const FlipCaseFn flip_case = select_flip_case();
+
+/**
+ * =============================================================================
+ * End Case conversion
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * Byte replacement
+ * =============================================================================
+ */
+
+/**
+ * Replaces every from byte with to in place and returns true when at least one
+ * byte changed. Vector variants compare a whole register against from and blend
+ * to in with an xor, they are picked at runtime; the tails are done byte by byte
+ */
+using ReplaceByteFn = bool (*)(char* data, size_t size, char from, char to);
+
+bool replace_byte_scalar(char* data, size_t size, char from, char to) {
+  bool changed = false;
+  for (size_t idx = 0; idx < size; ++idx) {
+    if (data[idx] == from) {
+      data[idx] = to;
+      changed = true;
+    }
+  }
+  return changed && from != to;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+bool replace_byte_sse2(char* data, size_t size, char from, char to) {
+  const __m128i needle = _mm_set1_epi8(from);
+  // x ^ (from ^ to) == to for x == from
+  const __m128i delta = _mm_set1_epi8(static_cast<char>(from ^ to));
+  __m128i matched = _mm_setzero_si128();
+  size_t idx = 0;
+  for (; idx + 16 <= size; idx += 16) {
+    __m128i* ptr = reinterpret_cast<__m128i*>(data + idx);
+    __m128i chunk = _mm_loadu_si128(ptr);
+    __m128i mask = _mm_and_si128(_mm_cmpeq_epi8(chunk, needle), delta);
+    matched = _mm_or_si128(matched, mask);
+    _mm_storeu_si128(ptr, _mm_xor_si128(chunk, mask));
+  }
+  bool changed = _mm_movemask_epi8(_mm_cmpeq_epi8(matched, _mm_setzero_si128())) != 0xFFFF;
+  return replace_byte_scalar(data + idx, size - idx, from, to) || changed;
+}
+
+__attribute__((target("avx2")))
+bool replace_byte_avx2(char* data, size_t size, char from, char to) {
+  const __m256i needle = _mm256_set1_epi8(from);
+  const __m256i delta = _mm256_set1_epi8(static_cast<char>(from ^ to));
+  __m256i matched = _mm256_setzero_si256();
+  size_t idx = 0;
+  for (; idx + 32 <= size; idx += 32) {
+    __m256i* ptr = reinterpret_cast<__m256i*>(data + idx);
+    __m256i chunk = _mm256_loadu_si256(ptr);
+    __m256i mask = _mm256_and_si256(_mm256_cmpeq_epi8(chunk, needle), delta);
+    matched = _mm256_or_si256(matched, mask);
+    _mm256_storeu_si256(ptr, _mm256_xor_si256(chunk, mask));
+  }
+  bool changed = !_mm256_testz_si256(matched, matched);
+  return replace_byte_scalar(data + idx, size - idx, from, to) || changed;
+}
+#endif
+
+ReplaceByteFn select_replace_byte() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return replace_byte_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return replace_byte_sse2;
+  }
+#endif
+  return replace_byte_scalar;
+}
+
+const ReplaceByteFn replace_byte = select_replace_byte();
+
+/**
+ * =============================================================================
+ * End Byte replacement
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * Byte maps
+ * =============================================================================
+ */
+
+ByteMap::ByteMap() {
+  for (int idx = 0; idx < 256; ++idx) {
+    this->table_[idx] = static_cast<unsigned char>(idx);
+  }
+}
+bool ByteMap::is_identity() const {
+  for (int idx = 0; idx < 256; ++idx) {
+    if (this->table_[idx] != idx) {
+      return false;
+    }
+  }
+  return true;
+}
+void ByteMap::compile() {
+  this->case_first_ = 0;
+  this->replace_from_ = -1;
+  this->shuffle_rows_ = -1;
+  for (char first : {'A', 'a'}) {
+    ByteMap flip;
+    flip.then([first](unsigned char c) {
+      return static_cast<unsigned char>(c - first) < 26 ? c ^ 0x20 : c;
+    });
+    if (flip.table_ == this->table_) {
+      this->case_first_ = first;
+      return;
+    }
+  }
+  int changed_entries = 0;
+  int last_changed = -1;
+  for (int idx = 0; idx < 256; ++idx) {
+    if (this->table_[idx] != idx) {
+      last_changed = idx;
+      ++changed_entries;
+    }
+  }
+  if (changed_entries == 1) {
+    this->replace_from_ = last_changed;
+    this->replace_to_ = static_cast<char>(this->table_[last_changed]);
+    return;
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("ssse3")) {
+    return;
+  }
+  int rows = 0;
+  for (int row = 0; row < 16; ++row) {
+    bool dirty = false;
+    for (int lo = 0; lo < 16; ++lo) {
+      dirty |= this->table_[row * 16 + lo] != row * 16 + lo;
+    }
+    if (!dirty) {
+      continue;
+    }
+    if (rows == kMaxShuffleRows) {
+      return;
+    }
+    this->row_nibbles_[rows] = static_cast<unsigned char>(row);
+    std::memcpy(this->rows_[rows], &this->table_[row * 16], 16);
+    ++rows;
+  }
+  this->shuffle_rows_ = rows;
+#endif
+}
+bool ByteMap::apply(char* data, size_t size) const {
+  if (this->case_first_ != 0) {
+    return flip_case(data, size, this->case_first_);
+  }
+  if (this->replace_from_ >= 0) {
+    return replace_byte(data, size, static_cast<char>(this->replace_from_), this->replace_to_);
+  }
+  if (this->shuffle_rows_ >= 0) {
+    return apply_shuffle(data, size);
+  }
+  return apply_scalar(data, size);
+}
+bool ByteMap::apply_scalar(char* data, size_t size) const {
+  unsigned char diff = 0;
+  for (size_t idx = 0; idx < size; ++idx) {
+    auto c = static_cast<unsigned char>(data[idx]);
+    diff |= c ^ this->table_[c];
+    data[idx] = static_cast<char>(this->table_[c]);
+  }
+  return diff != 0;
+}
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("ssse3")))
+bool ByteMap::apply_shuffle(char* data, size_t size) const {
+  const __m128i low_nibble = _mm_set1_epi8(0x0F);
+  __m128i diff = _mm_setzero_si128();
+  size_t idx = 0;
+  for (; idx + 16 <= size; idx += 16) {
+    __m128i* ptr = reinterpret_cast<__m128i*>(data + idx);
+    __m128i chunk = _mm_loadu_si128(ptr);
+    __m128i lo = _mm_and_si128(chunk, low_nibble);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(chunk, 4), low_nibble);
+    __m128i result = chunk;
+    for (int row = 0; row < this->shuffle_rows_; ++row) {
+      __m128i in_row = _mm_cmpeq_epi8(hi, _mm_set1_epi8(this->row_nibbles_[row]));
+      __m128i looked_up = _mm_shuffle_epi8(
+          _mm_load_si128(reinterpret_cast<const __m128i*>(this->rows_[row])), lo);
+      result = _mm_or_si128(_mm_and_si128(in_row, looked_up), _mm_andnot_si128(in_row, result));
+    }
+    diff = _mm_or_si128(diff, _mm_xor_si128(chunk, result));
+    _mm_storeu_si128(ptr, result);
+  }
+  bool changed = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF;
+  return apply_scalar(data + idx, size - idx) || changed;
+}
+#else
+bool ByteMap::apply_shuffle(char* data, size_t size) const {
+  return apply_scalar(data, size);
+}
+#endif
+
+/**
+ * =============================================================================
+ * End Byte maps
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * Commands
+ * =============================================================================
+ */
+
+bool LowerCaseCommand::apply(std::pmr::string& field) {
+  return flip_case(&field[0], field.size(), 'A');
+}
+
+bool UpperCaseCommand::apply(std::pmr::string& field) {
+  return flip_case(&field[0], field.size(), 'a');
+}
+
+ReplaceCommand::ReplaceCommand(int n, std::vector<std::pair<char, char>> pairs)
+    : field_(n), pairs_(std::move(pairs)) {
+  const std::vector<std::pair<char, char>>& replace = this->pairs_;
+  this->map_.then([&replace](unsigned char c) {
+    for (auto& pair : replace) {
+      if (static_cast<unsigned char>(pair.first) == c) {
+        return static_cast<unsigned char>(pair.second);
+      }
+    }
+    return c;
+  });
+  this->map_.compile();
+}
+bool ReplaceCommand::apply(std::pmr::string& field) {
+  if (this->pairs_.size() == 1) {
+    return replace_byte(&field[0], field.size(), this->pairs_[0].first, this->pairs_[0].second);
+  }
+  return this->map_.apply(&field[0], field.size());
+}
+
+/**
+ * =============================================================================
+ * End Commands
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * Execution plan
+ * =============================================================================
+ */
+
+ExecutionPlan::ExecutionPlan(std::vector<std::unique_ptr<Command>> commands)
+    : commands_(std::move(commands)) {
+  std::vector<std::pair<int, std::vector<size_t>>> by_field;
+  for (size_t idx = 0; idx < this->commands_.size(); ++idx) {
+    int field = this->commands_[idx]->field();
+    // a negative field never matches
+    if (field < 0) {
+      continue;
+    }
+    auto it = std::lower_bound(
+        by_field.begin(), by_field.end(), field,
+        [](const std::pair<int, std::vector<size_t>>& entry, int field) { return entry.first < field; });
+    if (it == by_field.end() || it->first != field) {
+      it = by_field.insert(it, {field, {}});
+    }
+    it->second.push_back(idx);
+  }
+  for (auto& entry : by_field) {
+    FieldStep step{entry.first, {}};
+    fuse(step, entry.second);
+    this->steps_.push_back(std::move(step));
+  }
+  for (auto& map : this->maps_) {
+    map->compile();
+  }
+}
+void ExecutionPlan::fuse(FieldStep& step, const std::vector<size_t>& commands) {
+  ByteMap* current = nullptr;
+  for (size_t idx : commands) {
+    Command* command = this->commands_[idx].get();
+    if (current != nullptr && command->compose(*current)) {
+      step.ops.back().sources.push_back(idx);
+      continue;
+    }
+    auto map = std::make_unique<ByteMap>();
+    if (command->compose(*map)) {
+      current = map.get();
+      this->maps_.push_back(std::move(map));
+      step.ops.push_back(FieldOp{current, nullptr, {idx}});
+    } else {
+      current = nullptr;
+      step.ops.push_back(FieldOp{nullptr, command, {idx}});
+    }
+  }
+}
+
+/**
+ * =============================================================================
+ * End Execution plan
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * Statistics
+ * =============================================================================
+ */
+
+void RunStats::count_command(size_t idx, size_t bytes) {
+  if (this->command_calls.size() <= idx) {
+    this->command_calls.resize(idx + 1);
+    this->command_bytes.resize(idx + 1);
+  }
+  ++this->command_calls[idx];
+  this->command_bytes[idx] += bytes;
+}
+void RunStats::merge(const RunStats& other) {
+  this->bytes_read += other.bytes_read;
+  this->bytes_mapped += other.bytes_mapped;
+  this->lines_read += other.lines_read;
+  this->lines_changed += other.lines_changed;
+  this->bytes_written += other.bytes_written;
+  this->read_ns += other.read_ns;
+  this->tokenize_ns += other.tokenize_ns;
+  this->apply_ns += other.apply_ns;
+  this->write_ns += other.write_ns;
+  if (this->command_calls.size() < other.command_calls.size()) {
+    this->command_calls.resize(other.command_calls.size());
+    this->command_bytes.resize(other.command_bytes.size());
+  }
+  for (size_t idx = 0; idx < other.command_calls.size(); ++idx) {
+    this->command_calls[idx] += other.command_calls[idx];
+    this->command_bytes[idx] += other.command_bytes[idx];
+  }
+}
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * =============================================================================
+ * End Statistics
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * Delimiter scanning
+ * =============================================================================
+ */
+
+/**
+ * Returns a bitmask with bit i set when block[i] == delim, for a 64 byte block.
+ * The SSE2 and AVX2 variants are picked at runtime depending on the CPU
+ */
+using MatchBlockFn = uint64_t (*)(const char* block, char delim);
+
+uint64_t match_block_scalar(const char* block, char delim) {
+  uint64_t mask = 0;
+  for (int idx = 0; idx < 64; ++idx) {
+    mask |= uint64_t(block[idx] == delim) << idx;
+  }
+  return mask;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+uint64_t match_block_sse2(const char* block, char delim) {
+  const __m128i needle = _mm_set1_epi8(delim);
+  uint64_t mask = 0;
+  for (int idx = 0; idx < 64; idx += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + idx));
+    uint64_t bits = uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+    mask |= bits << idx;
+  }
+  return mask;
+}
+
+__attribute__((target("avx2")))
+uint64_t match_block_avx2(const char* block, char delim) {
+  const __m256i needle = _mm256_set1_epi8(delim);
+  __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+  __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+  uint64_t lo_bits = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle)));
+  uint64_t hi_bits = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle)));
+  return lo_bits | (hi_bits << 32);
+}
+#endif
+
+MatchBlockFn select_match_block() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return match_block_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return match_block_sse2;
+  }
+#endif
+  return match_block_scalar;
+}
+
+const MatchBlockFn match_block = select_match_block();
+
+/**
+ * Returns the position of the first delimiter at or after from, or the size of
+ * the data when there is none
+ */
+size_t DelimiterScanner::find(size_t from) {
+  while (from < data_.size()) {
+    size_t block = from & ~size_t(63);
+    if (block != this->block_) {
+      this->block_ = block;
+      this->mask_ = load_mask(block);
+    }
+    uint64_t pending = this->mask_ & (~uint64_t(0) << (from - block));
+    if (pending != 0) {
+      return block + __builtin_ctzll(pending);
+    }
+    from = block + 64;
+  }
+  return data_.size();
+}
+uint64_t DelimiterScanner::load_mask(size_t block) const {
+  if (block + 64 <= data_.size()) {
+    return match_block(data_.data() + block, delim_);
+  }
+  // tail shorter than a block
+  uint64_t mask = 0;
+  for (size_t idx = block; idx < data_.size(); ++idx) {
+    mask |= uint64_t(data_[idx] == delim_) << (idx - block);
+  }
+  return mask;
+}
+
+size_t find_delimiter_pair(std::string_view data, char delim) {
+  // whether the last byte of the previous block is a delimiter
+  uint64_t carry = 0;
+  size_t block = 0;
+  for (; block + 64 <= data.size(); block += 64) {
+    uint64_t mask = match_block(data.data() + block, delim);
+    // bit i is set when bytes i - 1 and i are both delimiters
+    uint64_t pairs = mask & ((mask << 1) | carry);
+    if (pairs != 0) {
+      return block + __builtin_ctzll(pairs) - 1;
+    }
+    carry = mask >> 63;
+  }
+  if (block < data.size()) {
+    // the last partial block is matched from a copy, the bytes past the data
+    // are no delimiters
+    alignas(64) char last[64];
+    std::memset(last, delim == 0 ? 1 : 0, sizeof(last));
+    std::memcpy(last, data.data() + block, data.size() - block);
+    uint64_t mask = match_block(last, delim);
+    uint64_t pairs = mask & ((mask << 1) | carry);
+    if (pairs != 0) {
+      return block + __builtin_ctzll(pairs) - 1;
+    }
+  }
+  return std::string_view::npos;
+}
+
+/**
+ * =============================================================================
+ * End Delimiter scanning
+ * =============================================================================
+ */
+
+std::string_view tokenize(
+    std::string_view str,
+    const char delim,
+    std::vector<std::string_view> &out,
+    size_t max_fields)
+{
+	DelimiterScanner scanner(str, delim);
+	size_t start = 0;
+	size_t count = 0;
+
+	while (start < str.size())
+	{
+		if (count == max_fields)
+		{
+			return str.substr(start);
+		}
+		size_t end = scanner.find(start);
+		// consecutive delimiters do not produce empty fields
+		if (end > start)
+		{
+			out.push_back(str.substr(start, end - start));
+			++count;
+		}
+		start = end + 1;
+	}
+	return {};
+}
+
+void parse_commands(const std::vector<std::string>& arguments, std::vector<std::unique_ptr<Command>>& commands) {
+  for (const std::string& cmd : arguments) {
+    std::vector<std::string_view> parts;
+    tokenize(cmd, ':', parts);
+
+    const std::string error = "unable to parse argument [" + cmd + "]";
+    if (parts.size() != 2) {
+      throw std::invalid_argument(error);
+    }
+    int field;
+    try {
+      field = std::stoi(std::string(parts[0]));
+    } catch (const std::logic_error&) {
+      throw std::invalid_argument(error);
+    }
+    if (parts[1] == "u") {
+      std::unique_ptr<Command> lower_case_command (new LowerCaseCommand(field));
+      commands.push_back(std::move(lower_case_command));
+    } else if (parts[1] == "U") {
+      std::unique_ptr<Command> upper_case_command (new UpperCaseCommand(field));
+      commands.push_back(std::move(upper_case_command));
+    } else {
+      // replace parsing, R followed by one or more pairs of characters
+      if (parts[1].size() < 3 || parts[1].size() % 2 != 1) {
+        throw std::invalid_argument(error);
+      }
+      // must start with 'R'
+      if (parts[1][0] != 'R') {
+        throw std::invalid_argument(error);
+      }
+      std::vector<std::pair<char, char>> pairs;
+      for (size_t pos = 1; pos < parts[1].size(); pos += 2) {
+        pairs.emplace_back(parts[1][pos], parts[1][pos + 1]);
+      }
+      std::unique_ptr<Command> replace_command (
+          new ReplaceCommand(field, std::move(pairs))
+      );
+      commands.push_back(std::move(replace_command));
+    }
+  }
+}
+
+void apply_commands(
+    std::string_view line,
+    const ExecutionPlan& plan,
+    bool& changed,
+    LineScratch& scratch
+    ) {
+  std::vector<std::string_view>& fields = scratch.fields;
+  std::pmr::vector<std::pmr::string>& owned = scratch.owned;
+  RunStats* stats = scratch.stats;
+  uint64_t start = stats != nullptr ? now_ns() : 0;
+  fields.clear();
+  scratch.tail = tokenize(line, '\t', fields, plan.field_count());
+  if (stats != nullptr) {
+    uint64_t now = now_ns();
+    stats->tokenize_ns += now - start;
+    start = now;
+  }
+  scratch.changed_fields.clear();
+  if (owned.size() < fields.size()) {
+    owned.resize(fields.size());
+  }
+  for (auto& step : plan.steps()) {
+    // steps are sorted, the remaining ones target missing fields as well
+    if (static_cast<size_t>(step.field) >= fields.size()) {
+      break;
+    }
+    std::pmr::string& storage = owned[step.field];
+    // commands modify the field in place, so it is copied into its storage,
+    // whose capacity is kept from line to line within a batch
+    storage.assign(fields[step.field]);
+    bool field_changed = false;
+    for (auto& op : step.ops) {
+      if (op.map != nullptr) {
+        field_changed |= op.map->apply(&storage[0], storage.size());
+      } else {
+        field_changed |= op.command->apply(storage);
+      }
+      if (stats != nullptr) {
+        for (size_t source : op.sources) {
+          stats->count_command(source, storage.size());
+        }
+      }
+    }
+    if (field_changed) {
+      scratch.changed_fields.push_back(step.field);
+      changed = true;
+    }
+  }
+  if (stats != nullptr) {
+    stats->apply_ns += now_ns() - start;
+  }
+}
+
+/**
+ * =============================================================================
+ * Input
+ * =============================================================================
+ */
+
+int open_input(const std::string& file_path) {
+  if (file_path == "-") {
+    return STDIN_FILENO;
+  }
+  int fd = open(file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(), "unable to open file [" + file_path + "]");
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  return fd;
+}
+
+InputBuffer::InputBuffer(int fd) {
+  struct stat st{};
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    mapping_ = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if (mapping_ != MAP_FAILED) {
+    size_ = st.st_size;
+    data_ = static_cast<const char*>(mapping_);
+    madvise(mapping_, size_, MADV_SEQUENTIAL);
+  }
+}
+InputBuffer::~InputBuffer() {
+  if (mapping_ != MAP_FAILED) {
+    munmap(mapping_, size_);
+  }
+}
+
+/**
+ * Reads a descriptor synchronously with read(2), works for any kind of input
+ */
+class FdSource : public ByteSource {
+ public:
+  explicit FdSource(int fd) : fd_(fd) {}
+  size_t read(char* data, size_t size) override;
+ private:
+  int fd_;
+};
+size_t FdSource::read(char* data, size_t size) {
+  for (;;) {
+    ssize_t n = ::read(this->fd_, data, size);
+    if (n >= 0) {
+      return n;
+    }
+    if (errno != EINTR) {
+      throw std::system_error(errno, std::generic_category(), "unable to read input");
+    }
+  }
+}
+
+/**
+ * Reads a regular file with io_uring, keeping up to depth reads of buffer_size
+ * bytes in flight at increasing offsets, so that the device keeps working while
+ * the lines already read are transformed. The buffers are registered with the
+ * ring when the memlock limit allows it. Completed buffers are copied out in
+ * file order and resubmitted for the next offset once consumed
+ */
+class UringSource : public ByteSource {
+ public:
+  /**
+   * Returns nullptr when fd is not a regular file or the kernel has no io_uring
+   * @param fd
+   * @param buffer_size
+   * @param depth
+   */
+  static std::unique_ptr<UringSource> create(int fd, size_t buffer_size, unsigned depth);
+  ~UringSource() override;
+  size_t read(char* data, size_t size) override;
+ private:
+  struct Slot {
+    std::unique_ptr<char[]> data;
+    struct iovec iov;
+    off_t offset = 0;
+    // 0 for an idle slot
+    size_t length = 0;
+    ssize_t result = 0;
+    bool pending = false;
+  };
+  UringSource(int fd, off_t file_size, size_t buffer_size, unsigned depth);
+  bool setup();
+  void submit(unsigned slot);
+  void wait(unsigned slot);
+  void complete(Slot& slot);
+  int fd_;
+  off_t file_size_;
+  size_t buffer_size_;
+  off_t next_offset_ = 0;
+  std::vector<Slot> slots_;
+  unsigned current_ = 0;
+  size_t consumed_ = 0;
+  int ring_fd_ = -1;
+  bool fixed_ = false;
+  void* sq_ring_ = MAP_FAILED;
+  size_t sq_ring_size_ = 0;
+  void* cq_ring_ = MAP_FAILED;
+  size_t cq_ring_size_ = 0;
+  void* sqes_ = MAP_FAILED;
+  size_t sqes_size_ = 0;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  struct io_uring_cqe* cqes_ = nullptr;
+};
+std::unique_ptr<UringSource> UringSource::create(int fd, size_t buffer_size, unsigned depth) {
+  struct stat st{};
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return nullptr;
+  }
+  std::unique_ptr<UringSource> source(new UringSource(fd, st.st_size, buffer_size, depth));
+  if (!source->setup()) {
+    return nullptr;
+  }
+  for (unsigned slot = 0; slot < depth && source->next_offset_ < source->file_size_; ++slot) {
+    source->submit(slot);
+  }
+  return source;
+}
+UringSource::UringSource(int fd, off_t file_size, size_t buffer_size, unsigned depth)
+    : fd_(fd), file_size_(file_size), buffer_size_(buffer_size), slots_(depth) {
+  for (auto& slot : this->slots_) {
+    slot.data.reset(new char[buffer_size]);
+    slot.iov = {slot.data.get(), buffer_size};
+  }
+}
+UringSource::~UringSource() {
+  // the kernel must be done with the buffers before they are freed
+  if (this->ring_fd_ >= 0) {
+    try {
+      for (unsigned slot = 0; slot < this->slots_.size(); ++slot) {
+        wait(slot);
+      }
+    } catch (const std::system_error&) {
+      // the ring can not tell when the reads in flight are done: their
+      // buffers are leaked rather than freed under the kernel
+      for (auto& slot : this->slots_) {
+        if (slot.pending) {
+          slot.data.release();
+        }
+      }
+    }
+  }
+  if (this->sqes_ != MAP_FAILED) {
+    munmap(this->sqes_, this->sqes_size_);
+  }
+  if (this->cq_ring_ != MAP_FAILED && this->cq_ring_ != this->sq_ring_) {
+    munmap(this->cq_ring_, this->cq_ring_size_);
+  }
+  if (this->sq_ring_ != MAP_FAILED) {
+    munmap(this->sq_ring_, this->sq_ring_size_);
+  }
+  if (this->ring_fd_ >= 0) {
+    close(this->ring_fd_);
+  }
+}
+bool UringSource::setup() {
+  struct io_uring_params params{};
+  this->ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, this->slots_.size(), &params));
+  if (this->ring_fd_ < 0) {
+    return false;
+  }
+  this->sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  this->cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    this->sq_ring_size_ = this->cq_ring_size_ = std::max(this->sq_ring_size_, this->cq_ring_size_);
+  }
+  this->sq_ring_ = mmap(nullptr, this->sq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, this->ring_fd_, IORING_OFF_SQ_RING);
+  if (this->sq_ring_ == MAP_FAILED) {
+    return false;
+  }
+  this->cq_ring_ = single_mmap ? this->sq_ring_
+                               : mmap(nullptr, this->cq_ring_size_, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, this->ring_fd_, IORING_OFF_CQ_RING);
+  if (this->cq_ring_ == MAP_FAILED) {
+    return false;
+  }
+  this->sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  this->sqes_ = mmap(nullptr, this->sqes_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, this->ring_fd_, IORING_OFF_SQES);
+  if (this->sqes_ == MAP_FAILED) {
+    return false;
+  }
+  char* sq = static_cast<char*>(this->sq_ring_);
+  char* cq = static_cast<char*>(this->cq_ring_);
+  this->sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  this->sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  this->sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  this->cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  this->cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  this->cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  this->cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  // registering pins the buffers, which may exceed RLIMIT_MEMLOCK; plain reads work without
+  std::vector<struct iovec> iovs;
+  for (auto& slot : this->slots_) {
+    iovs.push_back(slot.iov);
+  }
+  this->fixed_ = syscall(__NR_io_uring_register, this->ring_fd_, IORING_REGISTER_BUFFERS,
+                         iovs.data(), iovs.size()) == 0;
+  return true;
+}
+void UringSource::submit(unsigned slot_idx) {
+  Slot& slot = this->slots_[slot_idx];
+  slot.offset = this->next_offset_;
+  slot.length = std::min<size_t>(this->buffer_size_, this->file_size_ - this->next_offset_);
+  slot.pending = true;
+  this->next_offset_ += slot.length;
+
+  unsigned tail = *this->sq_tail_;
+  unsigned index = tail & *this->sq_mask_;
+  auto* sqe = static_cast<struct io_uring_sqe*>(this->sqes_) + index;
+  std::memset(sqe, 0, sizeof(*sqe));
+  if (this->fixed_) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->addr = reinterpret_cast<uint64_t>(slot.data.get());
+    sqe->len = slot.length;
+    sqe->buf_index = slot_idx;
+  } else {
+    slot.iov.iov_len = slot.length;
+    sqe->opcode = IORING_OP_READV;
+    sqe->addr = reinterpret_cast<uint64_t>(&slot.iov);
+    sqe->len = 1;
+  }
+  sqe->fd = this->fd_;
+  sqe->off = slot.offset;
+  sqe->user_data = slot_idx;
+  this->sq_array_[index] = index;
+  __atomic_store_n(this->sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+  while (syscall(__NR_io_uring_enter, this->ring_fd_, 1, 0, 0, nullptr, 0) < 0) {
+    if (errno != EINTR && errno != EAGAIN) {
+      throw std::system_error(errno, std::generic_category(), "unable to submit read");
+    }
+  }
+}
+void UringSource::wait(unsigned slot_idx) {
+  while (this->slots_[slot_idx].pending) {
+    unsigned head = *this->cq_head_;
+    if (head == __atomic_load_n(this->cq_tail_, __ATOMIC_ACQUIRE)) {
+      if (syscall(__NR_io_uring_enter, this->ring_fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+          && errno != EINTR) {
+        throw std::system_error(errno, std::generic_category(), "unable to wait for read");
+      }
+      continue;
+    }
+    struct io_uring_cqe* cqe = &this->cqes_[head & *this->cq_mask_];
+    Slot& done = this->slots_[cqe->user_data];
+    done.result = cqe->res;
+    done.pending = false;
+    __atomic_store_n(this->cq_head_, head + 1, __ATOMIC_RELEASE);
+  }
+}
+void UringSource::complete(Slot& slot) {
+  if (slot.result < 0) {
+    throw std::system_error(-slot.result, std::generic_category(), "unable to read input");
+  }
+  // a short read is finished synchronously, a file truncated meanwhile just ends early
+  while (static_cast<size_t>(slot.result) < slot.length) {
+    ssize_t n = pread(this->fd_, slot.data.get() + slot.result, slot.length - slot.result,
+                      slot.offset + slot.result);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      slot.length = slot.result;
+      break;
+    }
+    slot.result += n;
+  }
+}
+size_t UringSource::read(char* data, size_t size) {
+  for (;;) {
+    Slot& slot = this->slots_[this->current_];
+    if (slot.length == 0) {
+      return 0;
+    }
+    if (slot.pending || this->consumed_ == 0) {
+      wait(this->current_);
+      complete(slot);
+    }
+    size_t available = slot.length - this->consumed_;
+    if (available == 0) {
+      slot.length = 0;
+      this->consumed_ = 0;
+      if (this->next_offset_ < this->file_size_) {
+        submit(this->current_);
+      }
+      this->current_ = (this->current_ + 1) % this->slots_.size();
+      continue;
+    }
+    // copied rather than handed out: blocks outlive the slot on the worker
+    // threads of the pipeline, and a line across two slots needs a copy
+    // anyway. The copy is from memory just written by the kernel, far cheaper
+    // than the read itself (BM_ReadBlocks compares it to read(2))
+    size_t n = std::min(size, available);
+    std::memcpy(data, slot.data.get() + this->consumed_, n);
+    this->consumed_ += n;
+    return n;
+  }
+}
+
+std::unique_ptr<ByteSource> open_source(int fd, bool io_uring) {
+  if (io_uring) {
+    const size_t buffer_size = 1 << 20;
+    const unsigned depth = 8;
+    if (auto source = UringSource::create(fd, buffer_size, depth)) {
+      return source;
+    }
+    std::cerr << "Warning: io_uring is not available for the input, using read(2)" << std::endl;
+  }
+  return std::make_unique<FdSource>(fd);
+}
+
+bool BlockReader::next(std::string& block) {
+  block.assign(this->carry_);
+  this->carry_.clear();
+  // bytes of block known to contain no new line
+  size_t searched = 0;
+  for (;;) {
+    if (this->eof_) {
+      break;
+    }
+    if (block.size() >= this->block_size_) {
+      size_t last = std::string_view(block).substr(searched).rfind('\n');
+      if (last != std::string_view::npos) {
+        this->carry_.assign(block, searched + last + 1, std::string::npos);
+        block.resize(searched + last + 1);
+        break;
+      }
+      searched = block.size();
+    }
+    size_t used = block.size();
+    size_t want = std::max(this->block_size_ - std::min(used, this->block_size_), size_t(64) << 10);
+    block.resize(used + want);
+    uint64_t start = this->stats_ != nullptr ? now_ns() : 0;
+    size_t n = this->source_.read(&block[used], want);
+    if (this->stats_ != nullptr) {
+      this->stats_->read_ns += now_ns() - start;
+    }
+    block.resize(used + n);
+    this->eof_ = n == 0;
+  }
+  return !block.empty();
+}
+
+/**
+ * =============================================================================
+ * End Input
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * Output
+ * =============================================================================
+ */
+
+void OutputWriter::write(std::string_view bytes) {
+  if (bytes.size() >= kMinCopy && copy_from_source(bytes)) {
+    return;
+  }
+  if (this->used_ + bytes.size() <= this->buffer_.size()) {
+    std::memcpy(this->buffer_.data() + this->used_, bytes.data(), bytes.size());
+    this->used_ += bytes.size();
+    return;
+  }
+  struct iovec iov[2] = {
+      {this->buffer_.data(), this->used_},
+      {const_cast<char*>(bytes.data()), bytes.size()},
+  };
+  write_all(iov, 2);
+  this->used_ = 0;
+}
+void OutputWriter::set_source(int fd, std::string_view data) {
+  struct stat st{};
+  this->source_fd_ = fd;
+  this->source_ = data;
+  this->regular_output_ = fstat(this->fd_, &st) == 0 && S_ISREG(st.st_mode);
+}
+/**
+ * Copies bytes in the kernel when they are a slice of the source. Returns false
+ * when they are not, or when the descriptors do not support it, in which case
+ * the source is dropped and the bytes are left to the regular path
+ * @param bytes
+ */
+bool OutputWriter::copy_from_source(std::string_view bytes) {
+  if (this->source_fd_ < 0 || bytes.data() < this->source_.data()
+      || bytes.data() + bytes.size() > this->source_.data() + this->source_.size()) {
+    return false;
+  }
+  flush();
+  uint64_t start = this->stats_ != nullptr ? now_ns() : 0;
+  off_t offset = bytes.data() - this->source_.data();
+  size_t left = bytes.size();
+  while (left > 0) {
+    ssize_t n = this->regular_output_
+        ? copy_file_range(this->source_fd_, &offset, this->fd_, nullptr, left, 0)
+        : sendfile(this->fd_, this->source_fd_, &offset, left);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      // e.g. an output opened with O_APPEND, a file system without support or
+      // a write error, that the regular path reports
+      this->source_fd_ = -1;
+      if (left == bytes.size()) {
+        return false;
+      }
+      write(bytes.substr(bytes.size() - left));
+      break;
+    }
+    left -= n;
+  }
+  if (this->stats_ != nullptr) {
+    this->stats_->bytes_written += bytes.size() - left;
+    this->stats_->write_ns += now_ns() - start;
+  }
+  return true;
+}
+void OutputWriter::put(char c) {
+  if (this->used_ == this->buffer_.size()) {
+    flush();
+  }
+  this->buffer_[this->used_++] = c;
+}
+void OutputWriter::end_line() {
+  put('\n');
+  if (this->flush_lines_ != 0 && ++this->pending_lines_ >= this->flush_lines_) {
+    flush();
+  }
+}
+void OutputWriter::write_lines(std::string_view bytes) {
+  while (this->flush_lines_ != 0 && !bytes.empty()) {
+    // the end of the line that reaches the flush interval, if bytes have it
+    size_t end = 0;
+    while (this->pending_lines_ < this->flush_lines_) {
+      auto* newline = static_cast<const char*>(memchr(bytes.data() + end, '\n', bytes.size() - end));
+      if (newline == nullptr) {
+        break;
+      }
+      end = newline - bytes.data() + 1;
+      ++this->pending_lines_;
+    }
+    if (this->pending_lines_ < this->flush_lines_) {
+      break;
+    }
+    write(bytes.substr(0, end));
+    flush();
+    bytes.remove_prefix(end);
+  }
+  write(bytes);
+}
+void OutputWriter::flush() {
+  struct iovec iov = {this->buffer_.data(), this->used_};
+  write_all(&iov, 1);
+  this->used_ = 0;
+  this->pending_lines_ = 0;
+}
+void OutputWriter::write_all(struct iovec* iov, int count) {
+  uint64_t start = this->stats_ != nullptr ? now_ns() : 0;
+  if (this->stats_ != nullptr) {
+    for (int idx = 0; idx < count; ++idx) {
+      this->stats_->bytes_written += iov[idx].iov_len;
+    }
+  }
+  while (count > 0) {
+    if (iov->iov_len == 0) {
+      ++iov;
+      --count;
+      continue;
+    }
+    ssize_t n = writev(this->fd_, iov, count);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::system_error(errno, std::generic_category(), "unable to write output");
+    }
+    // skip what was written, possibly in the middle of an iovec
+    while (count > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+  if (this->stats_ != nullptr) {
+    this->stats_->write_ns += now_ns() - start;
+  }
+}
+
+/**
+ * =============================================================================
+ * End Output
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * Processing
+ * =============================================================================
+ */
+
+/**
+ * Output of a chunk processed by a worker of process_parallel. Long slices of
+ * the input, such as the runs of unchanged lines with all_lines, are kept as
+ * views and written by the writer straight from the input, everything else is
+ * copied into a buffer
+ */
+class ChunkSink {
+ public:
+  explicit ChunkSink(std::string_view input) : input_(input) {}
+  /**
+   * Empties the sink for the output of another input
+   * @param input
+   */
+  void reset(std::string_view input) {
+    this->input_ = input;
+    clear();
+  }
+  void clear() {
+    this->bytes_.clear();
+    this->buffered_ = 0;
+    this->pieces_.clear();
+  }
+  void write(std::string_view bytes) {
+    if (bytes.size() >= kMinSlice && bytes.data() >= this->input_.data()
+        && bytes.data() + bytes.size() <= this->input_.data() + this->input_.size()) {
+      end_buffered();
+      this->pieces_.push_back({bytes.data(), bytes.size()});
+    } else {
+      this->bytes_.append(bytes);
+    }
+  }
+  void put(char c) { this->bytes_.push_back(c); }
+  void end_line() { this->bytes_.push_back('\n'); }
+  template <typename Writer>
+  void write_to(Writer& output) {
+    for_each_piece([&output](std::string_view bytes) { output.write(bytes); });
+  }
+  /**
+   * Writes the output into an OutputWriter, counting its lines towards the
+   * flush interval of the writer
+   * @param output
+   */
+  void write_lines_to(OutputWriter& output) {
+    for_each_piece([&output](std::string_view bytes) { output.write_lines(bytes); });
+  }
+ private:
+  template <typename Function>
+  void for_each_piece(Function function) {
+    end_buffered();
+    size_t offset = 0;
+    for (auto& piece : this->pieces_) {
+      if (piece.data != nullptr) {
+        function(std::string_view(piece.data, piece.size));
+      } else {
+        function(std::string_view(this->bytes_.data() + offset, piece.size));
+        offset += piece.size;
+      }
+    }
+  }
+  // a piece without data is the next size bytes of bytes_
+  struct Piece {
+    const char* data;
+    size_t size;
+  };
+  void end_buffered() {
+    if (this->bytes_.size() > this->buffered_) {
+      this->pieces_.push_back({nullptr, this->bytes_.size() - this->buffered_});
+      this->buffered_ = this->bytes_.size();
+    }
+  }
+  static const size_t kMinSlice = 4 << 10;
+  std::string_view input_;
+  std::string bytes_;
+  size_t buffered_ = 0;
+  std::vector<Piece> pieces_;
+};
+
+/**
+ * Splits data into chunks of about chunk_size bytes, each ending right after a
+ * new line character (or at the end of data)
+ * @param data
+ * @param chunk_size
+ * @param chunks
+ */
+void split_chunks(std::string_view data, size_t chunk_size, std::vector<std::string_view>& chunks) {
+  size_t pos = 0;
+  while (pos < data.size()) {
+    size_t end = pos + chunk_size;
+    if (end >= data.size()) {
+      end = data.size();
+    } else {
+      auto* eol = static_cast<const char*>(std::memchr(data.data() + end, '\n', data.size() - end));
+      end = eol ? eol - data.data() + 1 : data.size();
+    }
+    chunks.push_back(data.substr(pos, end - pos));
+    pos = end;
+  }
+}
+
+void process_parallel(
+    std::string_view data,
+    const ExecutionPlan& plan,
+    unsigned jobs,
+    OutputWriter& output,
+    bool all_lines,
+    SharedStats* stats
+    ) {
+  const size_t chunk_size = 4 << 20;
+  std::vector<std::string_view> chunks;
+  split_chunks(data, chunk_size, chunks);
+
+  struct Slot {
+    ChunkSink out;
+    bool ready;
+  };
+  const size_t window = 2 * size_t(jobs);
+  std::vector<Slot> slots(window, Slot{ChunkSink(data), false});
+  std::mutex mutex;
+  std::condition_variable slot_ready;
+  std::condition_variable slot_free;
+  size_t next_chunk = 0;
+  size_t next_write = 0;
+
+  auto worker = [&]() {
+    LocalStats local(stats);
+    LineScratch scratch;
+    scratch.stats = local.get();
+    for (;;) {
+      size_t idx;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        slot_free.wait(lock, [&] { return next_chunk >= chunks.size() || next_chunk < next_write + window; });
+        if (next_chunk >= chunks.size()) {
+          return;
+        }
+        idx = next_chunk++;
+      }
+      // the slot was written out and released before idx could be claimed
+      Slot& slot = slots[idx % window];
+      slot.out.clear();
+      process_lines(chunks[idx], plan, scratch, slot.out, all_lines);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        slot.ready = true;
+      }
+      slot_ready.notify_all();
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned idx = 0; idx < jobs; ++idx) {
+    workers.emplace_back(worker);
+  }
+
+  std::exception_ptr error;
+  try {
+    for (size_t idx = 0; idx < chunks.size(); ++idx) {
+      Slot& slot = slots[idx % window];
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        slot_ready.wait(lock, [&] { return slot.ready; });
+      }
+      slot.out.write_lines_to(output);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        slot.ready = false;
+        ++next_write;
+      }
+      slot_free.notify_all();
+    }
+  } catch (...) {
+    error = std::current_exception();
+    std::lock_guard<std::mutex> lock(mutex);
+    next_chunk = chunks.size();
+  }
+  slot_free.notify_all();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+/**
+ * =============================================================================
+ * End Processing
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * In-place rewrite
+ * =============================================================================
+ */
+
+/**
+ * Applies the plan to every line of data, a writable mapping of the file, and
+ * copies the changed fields back over the original ones. Only the pages with a
+ * changed field are dirtied. The plan must preserve the length of the fields
+ * @param data
+ * @param plan
+ * @param scratch buffers of the calling thread
+ */
+void rewrite_lines(std::string_view data, const ExecutionPlan& plan, LineScratch& scratch) {
+  RunStats* stats = scratch.stats;
+  if (stats != nullptr) {
+    stats->bytes_read += data.size();
+  }
+  for_each_line(data, [&](std::string_view line) {
+    bool changed = false;
+    apply_commands(line, plan, changed, scratch);
+    if (stats != nullptr) {
+      ++stats->lines_read;
+      stats->lines_changed += changed;
+    }
+    if (!changed) {
+      return;
+    }
+    for (size_t idx : scratch.changed_fields) {
+      std::string_view field = scratch.fields[idx];
+      std::memcpy(const_cast<char*>(field.data()), scratch.owned[idx].data(), field.size());
+      if (stats != nullptr) {
+        stats->bytes_written += field.size();
+      }
+    }
+  });
+  scratch.reset_batch();
+}
+
+/**
+ * Rewrites the file through a shared writable mapping, on jobs threads that
+ * claim chunks of the file in turn, and syncs it to disk. Throws
+ * std::system_error if the file can not be mapped or synced
+ * @param file_path
+ * @param fd opened for reading and writing
+ * @param size
+ * @param plan
+ * @param jobs
+ * @param stats counters of the run, may be null
+ */
+void rewrite_mapped(
+    const std::string& file_path,
+    int fd,
+    size_t size,
+    const ExecutionPlan& plan,
+    unsigned jobs,
+    SharedStats* stats
+    ) {
+  void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    throw std::system_error(errno, std::generic_category(), "unable to map file [" + file_path + "]");
+  }
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  std::string_view data(static_cast<const char*>(mapping), size);
+  {
+    LocalStats local(stats);
+    if (local.get() != nullptr) {
+      local.get()->bytes_mapped += size;
+    }
+  }
+  std::vector<std::string_view> chunks;
+  split_chunks(data, 4 << 20, chunks);
+  std::atomic<size_t> next_chunk{0};
+  auto worker = [&]() {
+    LocalStats local(stats);
+    LineScratch scratch;
+    scratch.stats = local.get();
+    for (size_t idx = next_chunk++; idx < chunks.size(); idx = next_chunk++) {
+      rewrite_lines(chunks[idx], plan, scratch);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned idx = 1; idx < jobs; ++idx) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+  int error = msync(mapping, size, MS_SYNC) == 0 ? 0 : errno;
+  munmap(mapping, size);
+  if (error != 0) {
+    throw std::system_error(error, std::generic_category(), "unable to write file [" + file_path + "]");
+  }
+}
+
+/**
+ * Writes the whole file with the plan applied into a temporary file in the
+ * same directory, syncs it and renames it over the original one, so that the
+ * file is either the old or the new one whenever the run is interrupted. The
+ * temporary file gets the owner and the mode of the file before any data.
+ * Throws std::system_error if the file can not be replaced, after removing
+ * the temporary file, e.g. when its owner can not be kept
+ * @param file_path the file itself, not a symbolic link to it
+ * @param file_path
+ * @param fd opened for reading
+ * @param st status of the file
+ * @param plan
+ * @param jobs
+ * @param stats counters of the run, may be null
+ */
+void rewrite_through_temp(
+    const std::string& file_path,
+    int fd,
+    const struct stat& st,
+    const ExecutionPlan& plan,
+    unsigned jobs,
+    SharedStats* stats
+    ) {
+  std::string temp_path = file_path + ".XXXXXX";
+  int temp_fd = mkstemp(&temp_path[0]);
+  if (temp_fd < 0) {
+    throw std::system_error(errno, std::generic_category(), "unable to create temporary file [" + temp_path + "]");
+  }
+  try {
+    // the owner first, changing it may clear the set-user-ID bits
+    if (fchown(temp_fd, st.st_uid, st.st_gid) != 0) {
+      throw std::system_error(errno, std::generic_category(), "unable to keep the owner of file [" + file_path + "]");
+    }
+    if (fchmod(temp_fd, st.st_mode & 07777) != 0) {
+      throw std::system_error(errno, std::generic_category(), "unable to keep the mode of file [" + file_path + "]");
+    }
+    LocalStats local(stats);
+    OutputWriter output(temp_fd);
+    output.set_stats(local.get());
+    InputBuffer input(fd);
+    if (!input.mapped()) {
+      // an empty view would replace the file with nothing
+      throw std::runtime_error("unable to map file [" + file_path + "]");
+    }
+    output.set_source(fd, input.data());
+    if (local.get() != nullptr) {
+      local.get()->bytes_mapped += input.data().size();
+    }
+    if (jobs > 1) {
+      process_parallel(input.data(), plan, jobs, output, true, stats);
+    } else {
+      LineScratch scratch;
+      scratch.stats = local.get();
+      process_lines(input.data(), plan, scratch, output, true);
+    }
+    output.flush();
+    if (fsync(temp_fd) != 0) {
+      throw std::system_error(errno, std::generic_category(), "unable to write file [" + temp_path + "]");
+    }
+  } catch (...) {
+    close(temp_fd);
+    unlink(temp_path.c_str());
+    throw;
+  }
+  if (close(temp_fd) != 0 || rename(temp_path.c_str(), file_path.c_str()) != 0) {
+    int error = errno;
+    unlink(temp_path.c_str());
+    throw std::system_error(error, std::generic_category(), "unable to replace file [" + file_path + "]");
+  }
+  // make the rename itself durable
+  size_t slash = file_path.rfind('/');
+  std::string directory = slash == std::string::npos ? "." : file_path.substr(0, slash + 1);
+  int directory_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if (directory_fd >= 0) {
+    fsync(directory_fd);
+    close(directory_fd);
+  }
+}
+
+/**
+ * Rewrites a regular file with the plan applied, in place when the plan
+ * preserves the length of the fields and through a temporary file when it
+ * does not or when atomic is set. A symbolic link is followed, so that its
+ * target is rewritten; a file with several hard links is not replaced.
+ * Throws std::runtime_error if the file can not be rewritten
+ * @param file_path
+ * @param plan
+ * @param jobs
+ * @param atomic replace the file as a whole instead of writing into it
+ * @param stats counters of the run, may be null
+ */
+void rewrite_file(
+    const std::string& file_path,
+    const ExecutionPlan& plan,
+    unsigned jobs,
+    bool atomic,
+    SharedStats* stats
+    ) {
+  bool mapped = plan.preserves_length() && !atomic;
+  int fd = open(file_path.c_str(), mapped ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(), "unable to rewrite file [" + file_path + "]");
+  }
+  try {
+    struct stat st{};
+    if (fstat(fd, &st) != 0) {
+      throw std::system_error(errno, std::generic_category(), "unable to rewrite file [" + file_path + "]");
+    }
+    if (!S_ISREG(st.st_mode)) {
+      throw std::runtime_error("unable to rewrite file [" + file_path + "]: not a regular file");
+    }
+    if (st.st_size > 0) {
+      if (mapped) {
+        rewrite_mapped(file_path, fd, st.st_size, plan, jobs, stats);
+      } else {
+        // a new file would only replace one of the names of the data
+        if (st.st_nlink > 1) {
+          throw std::runtime_error("unable to replace file [" + file_path + "]: it has "
+                                   + std::to_string(st.st_nlink) + " hard links");
+        }
+        // the temporary file goes next to the target of a symbolic link, which
+        // is what gets replaced
+        std::unique_ptr<char, decltype(&free)> target(realpath(file_path.c_str(), nullptr), &free);
+        if (target == nullptr) {
+          throw std::system_error(errno, std::generic_category(), "unable to rewrite file [" + file_path + "]");
+        }
+        rewrite_through_temp(target.get(), fd, st, plan, jobs, stats);
+      }
+    }
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+}
+
+/**
+ * =============================================================================
+ * End In-place rewrite
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * Pipeline
+ * =============================================================================
+ */
+
+/**
+ * Bounded lock-free ring for exactly one producer and one consumer thread.
+ * Blocking push and pop retry with yield for a while, then sleep on a
+ * condition variable until the other side makes progress, so that a stage
+ * held up by a slow consumer or producer, the backpressure between pipeline
+ * stages, does not burn a core
+ */
+template <typename T>
+class SpscRing {
+ public:
+  explicit SpscRing(size_t capacity);
+  bool try_push(const T& value) {
+    if (!push_once(value)) {
+      return false;
+    }
+    wake();
+    return true;
+  }
+  bool try_pop(T& value) {
+    if (!pop_once(value)) {
+      return false;
+    }
+    wake();
+    return true;
+  }
+  void push(const T& value) {
+    wait_until([&]() { return push_once(value); });
+    wake();
+  }
+  T pop() {
+    T value;
+    wait_until([&]() { return pop_once(value); });
+    wake();
+    return value;
+  }
+ private:
+  static const int kSpins = 64;
+  bool push_once(const T& value);
+  bool pop_once(T& value);
+  template <typename Try>
+  void wait_until(Try attempt);
+  void wake();
+  std::vector<T> items_;
+  size_t mask_;
+  // next slot to read, owned by the consumer
+  alignas(64) std::atomic<size_t> head_{0};
+  // next slot to write, owned by the producer
+  alignas(64) std::atomic<size_t> tail_{0};
+  // threads asleep in wait_until, checked after every change of head or tail
+  alignas(64) std::atomic<int> sleepers_{0};
+  std::mutex mutex_;
+  std::condition_variable changed_;
+};
+template <typename T>
+SpscRing<T>::SpscRing(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  this->items_.resize(size);
+  this->mask_ = size - 1;
+}
+template <typename T>
+bool SpscRing<T>::push_once(const T& value) {
+  size_t tail = this->tail_.load(std::memory_order_relaxed);
+  if (tail - this->head_.load(std::memory_order_acquire) == this->items_.size()) {
+    return false;
+  }
+  this->items_[tail & this->mask_] = value;
+  this->tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+template <typename T>
+bool SpscRing<T>::pop_once(T& value) {
+  size_t head = this->head_.load(std::memory_order_relaxed);
+  if (head == this->tail_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  value = this->items_[head & this->mask_];
+  this->head_.store(head + 1, std::memory_order_release);
+  return true;
+}
+/**
+ * Retries attempt, a push_once or pop_once, until it succeeds. The caller
+ * wakes the other side afterwards, outside the lock
+ */
+template <typename T>
+template <typename Try>
+void SpscRing<T>::wait_until(Try attempt) {
+  for (int spin = 0; spin < kSpins; ++spin) {
+    if (attempt()) {
+      return;
+    }
+    std::this_thread::yield();
+  }
+  std::unique_lock<std::mutex> lock(this->mutex_);
+  // announced before the last attempt: either the attempt sees the change of
+  // the other side, or the other side sees the sleeper and wakes it
+  this->sleepers_.fetch_add(1, std::memory_order_seq_cst);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  while (!attempt()) {
+    this->changed_.wait(lock);
+  }
+  this->sleepers_.fetch_sub(1, std::memory_order_relaxed);
+}
+template <typename T>
+void SpscRing<T>::wake() {
+  // orders the store of head or tail before the load of sleepers_
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (this->sleepers_.load(std::memory_order_relaxed) != 0) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->changed_.notify_all();
+  }
+}
+
+/**
+ * Processes a stream with a reader thread, jobs transform threads and the
+ * calling thread as the writer. Every transform thread is a lane with its own
+ * input and output buffers; the reader deals blocks to the lanes round-robin
+ * and the writer collects them in the same order, so every ring has a single
+ * producer and a single consumer and the output order is kept. Buffers travel
+ * back to their producer through free rings, a null buffer ends the stream.
+ * A read or write error makes the reader end the stream early, the error is
+ * thrown once the threads are joined
+ * @param source
+ * @param plan
+ * @param jobs
+ * @param output
+ * @param all_lines see process_lines
+ * @param stats counters of the run, may be null
+ */
+void process_pipeline(
+    ByteSource& source,
+    const ExecutionPlan& plan,
+    unsigned jobs,
+    OutputWriter& output,
+    bool all_lines = false,
+    SharedStats* stats = nullptr
+    ) {
+  const size_t block_size = 4 << 20;
+  const size_t depth = 4;
+  struct Lane {
+    Lane() : input(depth), input_free(depth), output(depth), output_free(depth) {}
+    SpscRing<std::string*> input;
+    SpscRing<std::string*> input_free;
+    SpscRing<std::string*> output;
+    SpscRing<std::string*> output_free;
+  };
+  std::vector<std::unique_ptr<Lane>> lanes;
+  std::vector<std::unique_ptr<std::string>> buffers;
+  for (unsigned idx = 0; idx < jobs; ++idx) {
+    lanes.push_back(std::make_unique<Lane>());
+    for (size_t slot = 0; slot < depth; ++slot) {
+      buffers.push_back(std::make_unique<std::string>());
+      lanes.back()->input_free.push(buffers.back().get());
+      buffers.push_back(std::make_unique<std::string>());
+      lanes.back()->output_free.push(buffers.back().get());
+    }
+  }
+
+  std::exception_ptr read_error;
+  std::atomic<bool> stop{false};
+  std::thread reader([&]() {
+    LocalStats local(stats);
+    BlockReader blocks(source, block_size, local.get());
+    for (size_t idx = 0; !stop; ++idx) {
+      Lane& lane = *lanes[idx % jobs];
+      std::string* block = lane.input_free.pop();
+      bool more = false;
+      try {
+        more = blocks.next(*block);
+      } catch (...) {
+        read_error = std::current_exception();
+      }
+      if (!more) {
+        lane.input_free.push(block);
+        break;
+      }
+      lane.input.push(block);
+    }
+    for (auto& lane : lanes) {
+      lane->input.push(nullptr);
+    }
+  });
+  std::vector<std::thread> transforms;
+  for (auto& lane_ptr : lanes) {
+    Lane& lane = *lane_ptr;
+    transforms.emplace_back([&plan, &lane, all_lines, stats]() {
+      LocalStats local(stats);
+      LineScratch scratch;
+      scratch.stats = local.get();
+      while (std::string* block = lane.input.pop()) {
+        std::string* out = lane.output_free.pop();
+        out->clear();
+        StringSink sink(*out);
+        process_lines(*block, plan, scratch, sink, all_lines);
+        lane.input_free.push(block);
+        lane.output.push(out);
+      }
+      lane.output.push(nullptr);
+    });
+  }
+
+  // after a write error the remaining output is drained, so that every
+  // thread gets to the end of the stream
+  std::exception_ptr write_error;
+  for (size_t idx = 0;; ++idx) {
+    Lane& lane = *lanes[idx % jobs];
+    std::string* out = lane.output.pop();
+    if (out == nullptr) {
+      break;
+    }
+    if (!write_error) {
+      try {
+        output.write_lines(*out);
+      } catch (...) {
+        write_error = std::current_exception();
+        stop = true;
+      }
+    }
+    lane.output_free.push(out);
+  }
+  reader.join();
+  for (auto& thread : transforms) {
+    thread.join();
+  }
+  if (read_error) {
+    std::rethrow_exception(read_error);
+  }
+  if (write_error) {
+    std::rethrow_exception(write_error);
+  }
+}
+
+/**
+ * Processes a stream that can not be mapped on the calling thread, block by block
+ * @param source
+ * @param plan
+ * @param output
+ * @param all_lines see process_lines
+ * @param stats counters of the calling thread, may be null
+ */
+void process_stream(
+    ByteSource& source,
+    const ExecutionPlan& plan,
+    OutputWriter& output,
+    bool all_lines = false,
+    RunStats* stats = nullptr
+    ) {
+  const size_t block_size = 4 << 20;
+  BlockReader blocks(source, block_size, stats);
+  LineScratch scratch;
+  scratch.stats = stats;
+  std::string block;
+  while (blocks.next(block)) {
+    process_lines(block, plan, scratch, output, all_lines);
+  }
+}
+
+/**
+ * =============================================================================
+ * End Pipeline
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * Batch
+ * =============================================================================
+ */
+
+/**
+ * Reads the whole input that can not be mapped into contents. Throws
+ * std::system_error on a read error
+ * @param fd
+ * @param contents
+ * @param stats counters of the calling thread, may be null
+ */
+void read_all(int fd, std::string& contents, RunStats* stats = nullptr) {
+  FdSource source(fd);
+  const size_t block_size = 1 << 20;
+  for (;;) {
+    size_t used = contents.size();
+    contents.resize(used + block_size);
+    uint64_t start = stats != nullptr ? now_ns() : 0;
+    size_t n = source.read(&contents[used], block_size);
+    if (stats != nullptr) {
+      stats->read_ns += now_ns() - start;
+    }
+    contents.resize(used + n);
+    if (n == 0) {
+      return;
+    }
+  }
+}
+
+/**
+ * Processes one file of a batch on the calling thread, writing its output
+ * into the file path with the suffix appended, or rewriting it in place.
+ * Throws std::runtime_error if the file can not be processed
+ * @param file_path
+ * @param plan
+ * @param options
+ * @param stats counters of the run, may be null
+ */
+void process_to_file(const std::string& file_path, const ExecutionPlan& plan, const Options& options, SharedStats* stats) {
+  if (options.in_place) {
+    rewrite_file(file_path, plan, 1, options.atomic, stats);
+    return;
+  }
+  int fd = open_input(file_path);
+  std::string output_path = (file_path == "-" ? "stdin" : file_path) + options.output_suffix;
+  int output_fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  auto close_files = [fd, &output_fd]() {
+    if (output_fd >= 0) {
+      close(output_fd);
+    }
+    if (fd != STDIN_FILENO) {
+      close(fd);
+    }
+  };
+  if (output_fd < 0) {
+    int error = errno;
+    close_files();
+    throw std::system_error(error, std::generic_category(), "unable to create file [" + output_path + "]");
+  }
+  try {
+    LocalStats local(stats);
+    OutputWriter output(output_fd, options.flush_lines);
+    output.set_stats(local.get());
+    InputBuffer input(fd);
+    if (input.mapped()) {
+      output.set_source(fd, input.data());
+      LineScratch scratch;
+      scratch.stats = local.get();
+      if (scratch.stats != nullptr) {
+        scratch.stats->bytes_mapped += input.data().size();
+      }
+      process_lines(input.data(), plan, scratch, output, options.all_lines);
+    } else {
+      FdSource source(fd);
+      process_stream(source, plan, output, options.all_lines, local.get());
+    }
+    output.flush();
+  } catch (...) {
+    close_files();
+    throw;
+  }
+  close_files();
+}
+
+/**
+ * Processes many files on a pool of jobs threads, one file per thread at a
+ * time, with the plan compiled once. With --output-suffix or --in-place every
+ * file has its own output. Otherwise the outputs are written by the calling
+ * thread to output in the order of paths: a file stays open (and mapped) from
+ * the time a thread claims it until its output is written, and at most
+ * max_open files are claimed ahead of the writer. A file that can not be
+ * processed is reported to options.on_error and skipped; an error writing to
+ * output stops the batch and is thrown
+ * @param paths
+ * @param plan
+ * @param options
+ * @param output
+ * @param stats counters of the run, may be null
+ * @return false if any of the files could not be processed
+ */
+bool process_batch(
+    const std::vector<std::string>& paths,
+    const ExecutionPlan& plan,
+    const Options& options,
+    OutputWriter& output,
+    SharedStats* stats
+    ) {
+  std::atomic<bool> ok{true};
+  std::mutex error_mutex;
+  auto fail = [&](const std::exception& e) {
+    ok = false;
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if (options.on_error) {
+      options.on_error(e.what());
+    } else {
+      std::cerr << "Error: " << e.what() << std::endl;
+    }
+  };
+  unsigned jobs = std::max<size_t>(1, std::min<size_t>(options.jobs, paths.size()));
+  if (options.in_place || !options.output_suffix.empty()) {
+    std::atomic<size_t> next_path{0};
+    auto worker = [&]() {
+      for (size_t idx = next_path++; idx < paths.size(); idx = next_path++) {
+        try {
+          process_to_file(paths[idx], plan, options, stats);
+        } catch (const std::runtime_error& e) {
+          fail(e);
+        }
+      }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned idx = 1; idx < jobs; ++idx) {
+      workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+      thread.join();
+    }
+    return ok;
+  }
+
+  struct Slot {
+    int fd = -1;
+    std::unique_ptr<InputBuffer> input;
+    // the input when it can not be mapped
+    std::string contents;
+    std::unique_ptr<ChunkSink> out;
+    bool ready = false;
+  };
+  const size_t window = options.max_open;
+  std::vector<Slot> slots(window);
+  std::mutex mutex;
+  std::condition_variable slot_ready;
+  std::condition_variable slot_free;
+  size_t next_path = 0;
+  size_t next_write = 0;
+
+  auto worker = [&]() {
+    LocalStats local(stats);
+    LineScratch scratch;
+    scratch.stats = local.get();
+    for (;;) {
+      size_t idx;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        slot_free.wait(lock, [&] { return next_path >= paths.size() || next_path < next_write + window; });
+        if (next_path >= paths.size()) {
+          return;
+        }
+        idx = next_path++;
+      }
+      Slot& slot = slots[idx % window];
+      try {
+        slot.fd = open_input(paths[idx]);
+        slot.input = std::make_unique<InputBuffer>(slot.fd);
+        if (!slot.input->mapped()) {
+          read_all(slot.fd, slot.contents, scratch.stats);
+        } else if (scratch.stats != nullptr) {
+          scratch.stats->bytes_mapped += slot.input->data().size();
+        }
+        std::string_view data = slot.input->mapped() ? slot.input->data() : std::string_view(slot.contents);
+        slot.out = std::make_unique<ChunkSink>(data);
+        process_lines(data, plan, scratch, *slot.out, options.all_lines);
+      } catch (const std::runtime_error& e) {
+        fail(e);
+        // nothing of the file is written
+        slot.out.reset();
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        slot.ready = true;
+      }
+      slot_ready.notify_all();
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned idx = 0; idx < jobs; ++idx) {
+    workers.emplace_back(worker);
+  }
+
+  std::exception_ptr error;
+  try {
+    for (size_t idx = 0; idx < paths.size(); ++idx) {
+      Slot& slot = slots[idx % window];
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        slot_ready.wait(lock, [&] { return slot.ready; });
+      }
+      if (slot.out != nullptr) {
+        if (slot.input->mapped()) {
+          output.set_source(slot.fd, slot.input->data());
+        }
+        slot.out->write_lines_to(output);
+        output.set_source(-1, std::string_view());
+      }
+      if (slot.fd >= 0 && slot.fd != STDIN_FILENO) {
+        close(slot.fd);
+      }
+      slot.fd = -1;
+      slot.input.reset();
+      slot.out.reset();
+      std::string().swap(slot.contents);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        slot.ready = false;
+        ++next_write;
+      }
+      slot_free.notify_all();
+    }
+  } catch (...) {
+    error = std::current_exception();
+    std::lock_guard<std::mutex> lock(mutex);
+    next_path = paths.size();
+  }
+  slot_free.notify_all();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+  if (error) {
+    // the files claimed ahead of the failed write are still open
+    for (auto& slot : slots) {
+      if (slot.fd >= 0 && slot.fd != STDIN_FILENO) {
+        close(slot.fd);
+      }
+    }
+    std::rethrow_exception(error);
+  }
+  return ok;
+}
+
+/**
+ * =============================================================================
+ * End Batch
+ * =============================================================================
+ */
+
+/**
+ * Prints the counters of a run to stderr
+ * @param plan
+ * @param stats merged counters of all the threads of the run
+ * @param wall_ns
+ */
+void report_stats(const ExecutionPlan& plan, const RunStats& stats, uint64_t wall_ns) {
+  auto ms = [](uint64_t ns) { return ns / 1e6; };
+  double seconds = wall_ns / 1e9;
+  std::fprintf(stderr, "FileManipulator stats\n");
+  std::fprintf(stderr, "  read      %llu bytes, %llu lines\n",
+               (unsigned long long) stats.bytes_read, (unsigned long long) stats.lines_read);
+  std::fprintf(stderr, "  written   %llu bytes, %llu changed lines\n",
+               (unsigned long long) stats.bytes_written, (unsigned long long) stats.lines_changed);
+  // a mapped input is read by page faults during tokenize and apply
+  char read_time[64];
+  if (stats.bytes_mapped != 0 && stats.bytes_mapped == stats.bytes_read) {
+    std::snprintf(read_time, sizeof(read_time), "n/a (mapped)");
+  } else if (stats.bytes_mapped != 0) {
+    std::snprintf(read_time, sizeof(read_time), "%.3f ms + n/a for %llu mapped bytes",
+                  ms(stats.read_ns), (unsigned long long) stats.bytes_mapped);
+  } else {
+    std::snprintf(read_time, sizeof(read_time), "%.3f ms", ms(stats.read_ns));
+  }
+  std::fprintf(stderr, "  time      wall %.3f ms, read %s, tokenize %.3f ms, apply %.3f ms, write %.3f ms\n",
+               ms(wall_ns), read_time, ms(stats.tokenize_ns), ms(stats.apply_ns), ms(stats.write_ns));
+  if (seconds > 0) {
+    std::fprintf(stderr, "  throughput %.1f MB/s, %.0f lines/s\n",
+                 stats.bytes_read / seconds / 1e6, stats.lines_read / seconds);
+  }
+  for (size_t idx = 0; idx < plan.commands().size(); ++idx) {
+    uint64_t calls = idx < stats.command_calls.size() ? stats.command_calls[idx] : 0;
+    uint64_t bytes = idx < stats.command_bytes.size() ? stats.command_bytes[idx] : 0;
+    std::fprintf(stderr, "  command %-10s %llu calls, %llu bytes\n",
+                 plan.commands()[idx]->describe().c_str(), (unsigned long long) calls, (unsigned long long) bytes);
+  }
+}
+
+/**
+ * =============================================================================
+ * Library interface
+ * =============================================================================
+ */
+
+/**
+ * Passes the writes of process_lines on to the sink of Transformer
+ */
+class CallbackSink {
+ public:
+  explicit CallbackSink(const Transformer::Sink& sink) : sink_(sink) {}
+  void write(std::string_view bytes) {
+    if (!bytes.empty()) {
+      sink_(bytes);
+    }
+  }
+ private:
+  const Transformer::Sink& sink_;
+};
+
+/**
+ * Cuts a stream pushed in buffers of any size into batches of whole lines for
+ * process_lines. The line a buffer ends in the middle of is kept until the
+ * next push completes it. Writer is anything with write(std::string_view),
+ * slices of the pushed data are passed to it without a copy
+ */
+class LineFeeder {
+ public:
+  LineFeeder() : out_(std::string_view()) {}
+  /**
+   * Starts a new stream
+   * @param plan
+   * @param all_lines see process_lines
+   * @param max_line longest incomplete line kept between pushes
+   */
+  void reset(std::shared_ptr<const ExecutionPlan> plan, bool all_lines, size_t max_line = std::string::npos) {
+    this->plan_ = std::move(plan);
+    this->all_lines_ = all_lines;
+    this->max_line_ = max_line;
+    this->carry_.clear();
+  }
+  /**
+   * Counts into stats from now on
+   * @param stats counters of the calling thread, may be null
+   */
+  void set_stats(RunStats* stats) { this->scratch_.stats = stats; }
+  /**
+   * Throws std::length_error when the incomplete last line grows past max_line
+   * @param data
+   * @param writer
+   */
+  template <typename Writer>
+  void push(std::string_view data, Writer& writer);
+  /**
+   * Transforms the incomplete last line, if any
+   * @param writer
+   */
+  template <typename Writer>
+  void finish(Writer& writer);
+ private:
+  template <typename Writer>
+  void transform(std::string_view data, Writer& writer);
+  std::shared_ptr<const ExecutionPlan> plan_;
+  bool all_lines_ = false;
+  size_t max_line_ = std::string::npos;
+  LineScratch scratch_;
+  ChunkSink out_;
+  // the incomplete last line of the data pushed so far
+  std::string carry_;
+};
+template <typename Writer>
+void LineFeeder::push(std::string_view data, Writer& writer) {
+  if (!this->carry_.empty()) {
+    // complete the line left by the previous push first
+    size_t eol = data.find('\n');
+    if (eol == std::string_view::npos) {
+      if (data.size() > this->max_line_ - this->carry_.size()) {
+        throw std::length_error("line longer than " + std::to_string(this->max_line_) + " bytes");
+      }
+      this->carry_.append(data);
+      return;
+    }
+    this->carry_.append(data.substr(0, eol + 1));
+    transform(this->carry_, writer);
+    this->carry_.clear();
+    data.remove_prefix(eol + 1);
+  }
+  auto* last = static_cast<const char*>(memrchr(data.data(), '\n', data.size()));
+  size_t complete = last != nullptr ? last - data.data() + 1 : 0;
+  if (complete != 0) {
+    transform(data.substr(0, complete), writer);
+  }
+  if (data.size() - complete > this->max_line_) {
+    throw std::length_error("line longer than " + std::to_string(this->max_line_) + " bytes");
+  }
+  this->carry_.assign(data.substr(complete));
+}
+template <typename Writer>
+void LineFeeder::finish(Writer& writer) {
+  if (!this->carry_.empty()) {
+    transform(this->carry_, writer);
+    this->carry_.clear();
+  }
+}
+template <typename Writer>
+void LineFeeder::transform(std::string_view data, Writer& writer) {
+  this->out_.reset(data);
+  process_lines(data, *this->plan_, this->scratch_, this->out_, this->all_lines_);
+  this->out_.write_to(writer);
+}
+
+struct Transformer::State {
+  LineFeeder feeder;
+};
+
+Transformer::Transformer(const std::vector<std::string>& commands, bool all_lines) : state_(std::make_unique<State>()) {
+  std::vector<std::unique_ptr<Command>> parsed;
+  parse_commands(commands, parsed);
+  this->state_->feeder.reset(std::make_shared<const ExecutionPlan>(std::move(parsed)), all_lines);
+}
+Transformer::~Transformer() = default;
+Transformer::Transformer(Transformer&&) noexcept = default;
+Transformer& Transformer::operator=(Transformer&&) noexcept = default;
+
+void Transformer::push(std::string_view data, const Sink& sink) {
+  CallbackSink callback(sink);
+  this->state_->feeder.push(data, callback);
+}
+
+void Transformer::finish(const Sink& sink) {
+  CallbackSink callback(sink);
+  this->state_->feeder.finish(callback);
+}
+
+/**
+ * Runs the plan over the files, see run
+ * @param paths
+ * @param plan
+ * @param options
+ * @param stats counters of the run, may be null
+ * @return exit status
+ */
+int run_plan(const std::vector<std::string>& paths, const ExecutionPlan& plan, const Options& options, SharedStats* stats) {
+  LocalStats local(stats);
+  if (paths.size() > 1 || !options.output_suffix.empty()) {
+    OutputWriter output(STDOUT_FILENO, options.flush_lines);
+    output.set_stats(local.get());
+    bool ok = process_batch(paths, plan, options, output, stats);
+    output.flush();
+    return ok ? 0 : 1;
+  }
+
+  const std::string file_path = paths.empty() ? "-" : paths.front();
+  if (options.in_place) {
+    if (file_path == "-") {
+      throw std::invalid_argument("--in-place needs a file path");
+    }
+    rewrite_file(file_path, plan, options.jobs, options.atomic, stats);
+    return 0;
+  }
+
+  int fd = open_input(file_path);
+  try {
+    OutputWriter output(STDOUT_FILENO, options.flush_lines);
+    output.set_stats(local.get());
+    bool stream = options.pipeline || options.io_uring;
+    std::unique_ptr<InputBuffer> input;
+    if (!stream) {
+      input = std::make_unique<InputBuffer>(fd);
+      stream = !input->mapped();
+    }
+    if (stream) {
+      std::unique_ptr<ByteSource> source = open_source(fd, options.io_uring);
+      if (options.pipeline || options.jobs > 1) {
+        process_pipeline(*source, plan, options.jobs, output, options.all_lines, stats);
+      } else {
+        process_stream(*source, plan, output, options.all_lines, local.get());
+      }
+    } else {
+      output.set_source(fd, input->data());
+      if (local.get() != nullptr) {
+        local.get()->bytes_mapped += input->data().size();
+      }
+      if (options.jobs > 1) {
+        process_parallel(input->data(), plan, options.jobs, output, options.all_lines, stats);
+      } else {
+        LineScratch scratch;
+        scratch.stats = local.get();
+        process_lines(input->data(), plan, scratch, output, options.all_lines);
+      }
+    }
+    output.flush();
+  } catch (...) {
+    if (fd != STDIN_FILENO) {
+      close(fd);
+    }
+    throw;
+  }
+  if (fd != STDIN_FILENO) {
+    close(fd);
+  }
+  return 0;
+}
+
+int run(const std::vector<std::string>& paths, const std::vector<std::string>& arguments, const Options& options) {
+  // both divide the work, the command line maps -j 0 to the number of CPUs
+  if (options.jobs == 0) {
+    throw std::invalid_argument("jobs must be at least 1");
+  }
+  if (options.max_open == 0) {
+    throw std::invalid_argument("max_open must be at least 1");
+  }
+  std::vector<std::unique_ptr<Command>> commands;
+  parse_commands(arguments, commands);
+  ExecutionPlan plan(std::move(commands));
+  SharedStats stats;
+  uint64_t start = now_ns();
+  int status = run_plan(paths, plan, options, options.stats ? &stats : nullptr);
+  if (options.stats) {
+    report_stats(plan, stats.total(), now_ns() - start);
+  }
+  return status;
+}
+
+/**
+ * =============================================================================
+ * End Library interface
+ * =============================================================================
+ */
+
+/**
+ * =============================================================================
+ * Daemon
+ * =============================================================================
+ */
+
+/**
+ * The daemon and its clients exchange frames over a stream socket: a type byte,
+ * the payload length as a native uint32 and the payload. A request is a header
+ * frame, data frames and an end frame; the response is data frames and an end
+ * frame, or an error frame after which the daemon closes the connection. A
+ * connection carries any number of requests one after another
+ */
+const char kFrameHeader = 'H';
+const char kFrameData = 'D';
+const char kFrameEnd = 'F';
+const char kFrameError = 'E';
+// data frames are cut at this size, longer ones are refused by the daemon
+const size_t kFrameSize = 1 << 20;
+const size_t kMaxFrameSize = 64 << 20;
+
+/**
+ * Reads exactly size bytes, returns false at the end of the stream or on error
+ * @param fd
+ * @param data
+ * @param size
+ */
+bool read_full(int fd, char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = ::read(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * Writes a frame, without SIGPIPE when the peer is gone. Returns false on error
+ * @param fd
+ * @param type
+ * @param payload
+ */
+bool write_frame(int fd, char type, std::string_view payload) {
+  char header[5];
+  uint32_t size = payload.size();
+  header[0] = type;
+  std::memcpy(header + 1, &size, sizeof(size));
+  struct iovec iov[2] = {
+      {header, sizeof(header)},
+      {const_cast<char*>(payload.data()), payload.size()},
+  };
+  struct msghdr message{};
+  message.msg_iov = iov;
+  message.msg_iovlen = 2;
+  while (message.msg_iovlen > 0) {
+    ssize_t n = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return false;
+    }
+    // skip what was sent, possibly in the middle of an iovec
+    while (message.msg_iovlen > 0 && static_cast<size_t>(n) >= message.msg_iov->iov_len) {
+      n -= message.msg_iov->iov_len;
+      ++message.msg_iov;
+      --message.msg_iovlen;
+    }
+    if (message.msg_iovlen > 0) {
+      message.msg_iov->iov_base = static_cast<char*>(message.msg_iov->iov_base) + n;
+      message.msg_iov->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+/**
+ * Reads a frame into payload, whose capacity is reused. Returns false at the
+ * end of the stream, on error or on a frame longer than kMaxFrameSize
+ * @param fd
+ * @param type
+ * @param payload
+ */
+bool read_frame(int fd, char& type, std::string& payload) {
+  char header[5];
+  uint32_t size;
+  if (!read_full(fd, header, sizeof(header))) {
+    return false;
+  }
+  type = header[0];
+  std::memcpy(&size, header + 1, sizeof(size));
+  if (size > kMaxFrameSize) {
+    return false;
+  }
+  payload.resize(size);
+  return read_full(fd, &payload[0], size);
+}
+
+/**
+ * The header of a request: a for all lines or c for the changed ones, then the
+ * commands each followed by a zero byte. The daemon caches plans by it
+ * @param commands
+ * @param all_lines
+ */
+std::string encode_request(const std::vector<std::string>& commands, bool all_lines) {
+  std::string header(1, all_lines ? 'a' : 'c');
+  for (const std::string& command : commands) {
+    header.append(command);
+    header.push_back('\0');
+  }
+  return header;
+}
+
+/**
+ * Plans compiled by the daemon, shared by its workers and keyed by the request
+ * header. The cache is emptied when it reaches kMaxPlans, the plans in use are
+ * kept alive by their requests
+ */
+class PlanCache {
+ public:
+  /**
+   * Throws std::invalid_argument if the header has a wrong command
+   * @param header
+   */
+  std::shared_ptr<const ExecutionPlan> get(const std::string& header);
+ private:
+  static const size_t kMaxPlans = 1024;
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::shared_ptr<const ExecutionPlan>> plans_;
+};
+std::shared_ptr<const ExecutionPlan> PlanCache::get(const std::string& header) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    auto found = this->plans_.find(header);
+    if (found != this->plans_.end()) {
+      return found->second;
+    }
+  }
+  // compiled without the lock, two workers may race on a new header harmlessly
+  std::vector<std::string> arguments;
+  size_t pos = 1;
+  for (size_t end; (end = header.find('\0', pos)) != std::string::npos; pos = end + 1) {
+    arguments.emplace_back(header, pos, end - pos);
+  }
+  std::vector<std::unique_ptr<Command>> commands;
+  parse_commands(arguments, commands);
+  auto plan = std::make_shared<const ExecutionPlan>(std::move(commands));
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (this->plans_.size() >= kMaxPlans) {
+    this->plans_.clear();
+  }
+  this->plans_.emplace(header, plan);
+  return plan;
+}
+
+/**
+ * Writer of LineFeeder that sends the output as data frames of at most
+ * kFrameSize bytes. Long slices go out without a copy, in kFrameSize pieces
+ */
+class FrameWriter {
+ public:
+  /**
+   * @param fd
+   * @param buffer buffer of the calling worker
+   * @param stats counters of the calling worker, may be null
+   */
+  FrameWriter(int fd, std::string& buffer, RunStats* stats = nullptr) : fd_(fd), buffer_(buffer), stats_(stats) {
+    buffer_.clear();
+  }
+  void write(std::string_view bytes) {
+    if (this->stats_ != nullptr) {
+      this->stats_->bytes_written += bytes.size();
+    }
+    if (this->buffer_.size() + bytes.size() > kFrameSize) {
+      flush();
+    }
+    if (bytes.size() >= kFrameSize) {
+      // e.g. a long unchanged line with all lines, cut so that no frame
+      // passes the kMaxFrameSize a client accepts
+      for (size_t pos = 0; pos < bytes.size(); pos += kFrameSize) {
+        this->ok_ = this->ok_ && write_frame(this->fd_, kFrameData, bytes.substr(pos, kFrameSize));
+      }
+    } else {
+      this->buffer_.append(bytes);
+    }
+  }
+  /**
+   * Sends what is buffered, returns false if anything failed to be sent
+   */
+  bool flush() {
+    if (!this->buffer_.empty()) {
+      this->ok_ = this->ok_ && write_frame(this->fd_, kFrameData, this->buffer_);
+      this->buffer_.clear();
+    }
+    return this->ok_;
+  }
+ private:
+  int fd_;
+  std::string& buffer_;
+  RunStats* stats_;
+  bool ok_ = true;
+};
+
+/**
+ * Serves the requests of a connection until the client closes it or breaks
+ * the protocol. A line is limited to kMaxFrameSize bytes, so that a client
+ * that never sends a new line can not grow the daemon without bound
+ * @param fd
+ * @param cache
+ * @param feeder buffers of the calling worker, counting into stats
+ * @param payload buffer of the calling worker
+ * @param output buffer of the calling worker
+ * @param stats counters of the connection, may be null
+ * @return number of requests served
+ */
+size_t serve_connection(
+    int fd,
+    PlanCache& cache,
+    LineFeeder& feeder,
+    std::string& payload,
+    std::string& output,
+    RunStats* stats
+    ) {
+  size_t requests = 0;
+  char type;
+  while (read_frame(fd, type, payload)) {
+    if (type != kFrameHeader || payload.empty()) {
+      write_frame(fd, kFrameError, "expected a request header");
+      return requests;
+    }
+    try {
+      feeder.reset(cache.get(payload), payload[0] == 'a', kMaxFrameSize);
+    } catch (const std::invalid_argument& e) {
+      write_frame(fd, kFrameError, e.what());
+      return requests;
+    }
+    FrameWriter writer(fd, output, stats);
+    try {
+      for (;;) {
+        if (!read_frame(fd, type, payload)) {
+          return requests;
+        }
+        if (type == kFrameData) {
+          feeder.push(payload, writer);
+        } else if (type == kFrameEnd) {
+          feeder.finish(writer);
+          break;
+        } else {
+          write_frame(fd, kFrameError, "expected a data frame");
+          return requests;
+        }
+      }
+    } catch (const std::length_error& e) {
+      write_frame(fd, kFrameError, e.what());
+      return requests;
+    }
+    if (!writer.flush() || !write_frame(fd, kFrameEnd, std::string_view())) {
+      return requests;
+    }
+    ++requests;
+  }
+  return requests;
+}
+
+/**
+ * Reports the counters of a closed connection to stderr in a single write, so
+ * that the reports of the workers do not interleave
+ * @param stats
+ * @param requests
+ * @param wall_ns
+ */
+void report_connection(const RunStats& stats, size_t requests, uint64_t wall_ns) {
+  std::fprintf(stderr,
+               "FileManipulator stats: connection of %.3f ms, %zu requests, read %llu bytes, %llu lines, "
+               "written %llu bytes, %llu changed lines, tokenize %.3f ms, apply %.3f ms\n",
+               wall_ns / 1e6, requests, (unsigned long long) stats.bytes_read, (unsigned long long) stats.lines_read,
+               (unsigned long long) stats.bytes_written, (unsigned long long) stats.lines_changed,
+               stats.tokenize_ns / 1e6, stats.apply_ns / 1e6);
+}
+
+/**
+ * Opens a Unix stream socket and binds or connects it to socket_path. To
+ * listen, a socket left at socket_path is replaced, anything else there fails
+ * with EEXIST and is left alone
+ * @param socket_path
+ * @param listen bind and listen instead of connecting
+ * @return descriptor, negative with errno set on error
+ */
+int open_socket(const std::string& socket_path, bool listen) {
+  struct sockaddr_un address{};
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  if (listen) {
+    struct stat st{};
+    if (lstat(socket_path.c_str(), &st) == 0) {
+      if (!S_ISSOCK(st.st_mode)) {
+        errno = EEXIST;
+        return -1;
+      }
+      unlink(socket_path.c_str());
+    }
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  auto* generic = reinterpret_cast<struct sockaddr*>(&address);
+  int result = listen
+      ? (bind(fd, generic, sizeof(address)) == 0 ? ::listen(fd, SOMAXCONN) : -1)
+      : connect(fd, generic, sizeof(address));
+  if (result != 0) {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  return fd;
+}
+
+int serve(const std::string& socket_path, const Options& options) {
+  int listen_fd = open_socket(socket_path, true);
+  if (listen_fd < 0) {
+    std::cerr << "Error: unable to listen on socket [" << socket_path << "]: " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  PlanCache cache;
+  auto worker = [&]() {
+    LineFeeder feeder;
+    std::string payload;
+    std::string output;
+    for (;;) {
+      int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) {
+        int error = errno;
+        if (error == EINTR) {
+          continue;
+        }
+        // a single write, the workers may fail together
+        std::fprintf(stderr, "Warning: unable to accept a connection: %s\n", std::strerror(error));
+        // out of descriptors or memory (EMFILE, ENFILE, ENOBUFS, ENOMEM):
+        // wait for the connections being served to end instead of spinning
+        if (error != ECONNABORTED) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        continue;
+      }
+      RunStats stats;
+      feeder.set_stats(options.stats ? &stats : nullptr);
+      uint64_t start = options.stats ? now_ns() : 0;
+      size_t requests = serve_connection(fd, cache, feeder, payload, output, options.stats ? &stats : nullptr);
+      close(fd);
+      if (options.stats) {
+        report_connection(stats, requests, now_ns() - start);
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned idx = 1; idx < std::max(1u, options.jobs); ++idx) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  return 0;
+}
+
+/**
+ * Sends one request and writes its response to output
+ * @param fd
+ * @param header
+ * @param data
+ * @param output
+ * @param payload buffer for the response frames
+ * @return false if the daemon failed the request
+ */
+bool send_request(int fd, const std::string& header, std::string_view data, OutputWriter& output, std::string& payload) {
+  // the daemon answers while it reads, so a request that may not fit the
+  // socket buffers is sent from another thread while the response is read
+  auto send = [fd, &header, data]() {
+    bool sent = write_frame(fd, kFrameHeader, header);
+    for (size_t pos = 0; sent && pos < data.size(); pos += kFrameSize) {
+      sent = write_frame(fd, kFrameData, data.substr(pos, kFrameSize));
+    }
+    if (sent) {
+      write_frame(fd, kFrameEnd, std::string_view());
+    }
+  };
+  std::thread sender;
+  if (data.size() <= kFrameSize / 16) {
+    send();
+  } else {
+    sender = std::thread(send);
+  }
+  bool ok = false;
+  char type = 0;
+  std::exception_ptr error;
+  try {
+    while (read_frame(fd, type, payload)) {
+      if (type == kFrameData) {
+        output.write_lines(payload);
+      } else if (type == kFrameEnd) {
+        ok = true;
+        break;
+      } else {
+        std::cerr << "Error: " << (type == kFrameError ? payload : "unexpected response") << std::endl;
+        break;
+      }
+    }
+    if (!ok && type != kFrameError) {
+      std::cerr << "Error: the daemon closed the connection" << std::endl;
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+  if (sender.joinable()) {
+    // a failed request leaves the sender on a socket that is shut down below
+    if (!ok) {
+      shutdown(fd, SHUT_RDWR);
+    }
+    sender.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return ok;
+}
+
+int run_remote(
+    const std::string& socket_path,
+    const std::vector<std::string>& paths,
+    const std::vector<std::string>& commands,
+    const Options& options,
+    unsigned repeat
+    ) {
+  // wrong commands are reported here, like without a daemon
+  std::vector<std::unique_ptr<Command>> parsed;
+  parse_commands(commands, parsed);
+  int fd = open_socket(socket_path, false);
+  if (fd < 0) {
+    std::cerr << "Error: unable to connect to socket [" << socket_path << "]: " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  const std::string header = encode_request(commands, options.all_lines);
+  OutputWriter output(STDOUT_FILENO, options.flush_lines);
+  std::string payload;
+  std::vector<uint64_t> latencies;
+  bool ok = true;
+  try {
+    for (const std::string& file_path : paths.empty() ? std::vector<std::string>{"-"} : paths) {
+      int input_fd = open_input(file_path);
+      try {
+        InputBuffer input(input_fd);
+        std::string contents;
+        if (!input.mapped()) {
+          read_all(input_fd, contents);
+        }
+        std::string_view data = input.mapped() ? input.data() : std::string_view(contents);
+        for (unsigned round = 0; ok && round < repeat; ++round) {
+          uint64_t start = now_ns();
+          ok = send_request(fd, header, data, output, payload);
+          latencies.push_back(now_ns() - start);
+        }
+      } catch (...) {
+        if (input_fd != STDIN_FILENO) {
+          close(input_fd);
+        }
+        throw;
+      }
+      if (input_fd != STDIN_FILENO) {
+        close(input_fd);
+      }
+      if (!ok) {
+        break;
+      }
+    }
+    output.flush();
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+  if (options.stats && !latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    uint64_t total = 0;
+    for (uint64_t latency : latencies) {
+      total += latency;
+    }
+    std::fprintf(stderr, "FileManipulator requests\n");
+    std::fprintf(stderr, "  %zu requests, latency min %.1f us, median %.1f us, mean %.1f us, max %.1f us\n",
+                 latencies.size(), latencies.front() / 1e3, latencies[latencies.size() / 2] / 1e3,
+                 total / 1e3 / latencies.size(), latencies.back() / 1e3);
+  }
+  return ok ? 0 : 1;
+}
+
+/**
+ * =============================================================================
+ * End Daemon
+ * =============================================================================
+ */
+
+}  // namespace filemanipulator
@@ -0,0 +1,143 @@
+#ifndef FILEMANIPULATOR_H
+#define FILEMANIPULATOR_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * libfilemanipulator applies the FileManipulator commands to the tab separated
+ * fields of lines:
+ *   N:u          - field N to lower case letters
+ *   N:U          - field N to upper case letters
+ *   N:RABCD...   - A to B, C to D and so on in field N
+ * Fields are counted from 0, empty fields are skipped
+ */
+namespace filemanipulator {
+
+/**
+ * Options of a run, as given on the FileManipulator command line
+ */
+struct Options {
+  // flush the output after every flush_lines changed lines, 0 when it is full
+  size_t flush_lines = 0;
+  // threads transforming a file, or processing files of a batch, at least 1
+  unsigned jobs = 1;
+  // read in blocks on a reader thread instead of mapping the file
+  bool pipeline = false;
+  // read in blocks with io_uring instead of mapping the file
+  bool io_uring = false;
+  // report counters to stderr at the end of the run
+  bool stats = false;
+  // rewrite the files instead of writing to the standard output
+  bool in_place = false;
+  // with in_place, write a temporary file and rename it over the file instead
+  // of writing into the file, so that an interrupted run leaves the old file
+  bool atomic = false;
+  // write every line, not only the changed ones
+  bool all_lines = false;
+  // write the output of a file into its path with output_suffix appended
+  std::string output_suffix;
+  // input files of a batch kept open while their output waits to be written,
+  // at least 1
+  size_t max_open = 64;
+  // receives the error of a file of a batch, which is skipped while the others
+  // are processed; called by one thread at a time. Without it the error is
+  // written to stderr
+  std::function<void(const std::string& message)> on_error;
+};
+
+/**
+ * Streaming transformer: data is pushed in buffers of any size, cut anywhere,
+ * and the output of its complete lines is passed to a sink as it is made. The
+ * commands are compiled once, and the buffers of the object are reused from
+ * push to push and from stream to stream, so a Transformer is meant to be kept
+ * around. Not thread safe, use one per thread
+ */
+class Transformer {
+ public:
+  /**
+   * Receives the output in pieces, which are valid only during the call
+   */
+  using Sink = std::function<void(std::string_view)>;
+  /**
+   * Throws std::invalid_argument if a command can not be parsed
+   * @param commands one command each, e.g. 1:u
+   * @param all_lines write every line, not only the changed ones
+   */
+  explicit Transformer(const std::vector<std::string>& commands, bool all_lines = false);
+  ~Transformer();
+  Transformer(Transformer&&) noexcept;
+  Transformer& operator=(Transformer&&) noexcept;
+  /**
+   * Transforms the lines completed by data. An incomplete last line is kept
+   * until the push that completes it or finish
+   * @param data
+   * @param sink
+   */
+  void push(std::string_view data, const Sink& sink);
+  /**
+   * Transforms the incomplete last line, if any, and ends the stream. The next
+   * push starts a new stream
+   * @param sink
+   */
+  void finish(const Sink& sink);
+ private:
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+/**
+ * Runs the commands over the files like the FileManipulator program does,
+ * writing to the standard output unless options say otherwise. Throws
+ * std::invalid_argument if a command can not be parsed or the options do not
+ * fit the paths, and std::runtime_error (std::system_error for I/O errors) if
+ * a single file can not be processed or the output can not be written. In a
+ * batch of files the error of a file goes to options.on_error instead, the
+ * run goes on with the other files and returns 1. The counters asked for by
+ * options.stats belong to the run and are reported to stderr at its end
+ * @param paths no path or "-" reads the standard input
+ * @param commands one command each, e.g. 1:u
+ * @param options
+ * @return exit status
+ */
+int run(const std::vector<std::string>& paths, const std::vector<std::string>& commands, const Options& options);
+
+/**
+ * Serves requests on the Unix socket socket_path until the process is killed,
+ * with options.jobs worker threads that each serve one connection at a time.
+ * Plans are compiled once per distinct commands and all_lines. A socket file
+ * left at socket_path is replaced, any other file there is an error. A failed
+ * accept is reported to stderr and retried. With options.stats the counters
+ * of every connection are reported to stderr when it closes
+ * @param socket_path
+ * @param options
+ * @return exit status, when the socket can not be set up
+ */
+int serve(const std::string& socket_path, const Options& options);
+
+/**
+ * Like run, but the data is transformed by the daemon listening on socket_path,
+ * every file in its own request over one connection. Only options.all_lines,
+ * flush_lines and stats apply; with stats the request latencies are reported.
+ * Throws like run, a failed request is reported to stderr and returns 1
+ * @param socket_path
+ * @param paths
+ * @param commands
+ * @param options
+ * @param repeat number of times every file is sent, its output is written each time
+ * @return exit status
+ */
+int run_remote(
+    const std::string& socket_path,
+    const std::vector<std::string>& paths,
+    const std::vector<std::string>& commands,
+    const Options& options,
+    unsigned repeat = 1);
+
+}  // namespace filemanipulator
+
+#endif
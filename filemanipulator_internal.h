@@ -0,0 +1,768 @@
+#ifndef FILEMANIPULATOR_INTERNAL_H
+#define FILEMANIPULATOR_INTERNAL_H
+
+#include "filemanipulator.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+/**
+ * The engine behind filemanipulator.h, shared with the benchmarks and the
+ * tests. Not installed and not a stable interface
+ */
+namespace filemanipulator {
+
+/**
+ * =============================================================================
+ * Byte maps
+ * =============================================================================
+ */
+
+/**
+ * A 256-entry translation table. Commands that map every byte independently of
+ * its neighbours compose into one table, which is then applied to a field in a
+ * single in-place pass. A table that is exactly ASCII lower or upper casing
+ * runs the flip_case kernel, one that changes a single byte runs replace_byte.
+ * Otherwise, when all the bytes the table changes
+ * fall into a few 16-byte rows, the table is applied 16 bytes at a time with
+ * SSSE3 shuffles
+ */
+class ByteMap {
+ public:
+  ByteMap();
+  /**
+   * Maps every entry of the table through f, i.e. runs f after this map
+   * @param f
+   */
+  template <typename F>
+  void then(F f) {
+    for (auto& entry : this->table_) {
+      entry = static_cast<unsigned char>(f(entry));
+    }
+  }
+  bool is_identity() const;
+  unsigned char translate(unsigned char c) const { return table_[c]; }
+  /**
+   * Must be called once the table is final, picks the kernel used by apply
+   */
+  void compile();
+  /**
+   * Translates data in place, returns true when at least one byte changed
+   * @param data
+   * @param size
+   */
+  bool apply(char* data, size_t size) const;
+ private:
+  static const int kMaxShuffleRows = 4;
+  bool apply_scalar(char* data, size_t size) const;
+  bool apply_shuffle(char* data, size_t size) const;
+  std::array<unsigned char, 256> table_;
+  // first letter flipped by flip_case when the table is a case conversion, 0 otherwise
+  char case_first_ = 0;
+  // the only byte changed by the table and its replacement
+  int replace_from_ = -1;
+  char replace_to_ = 0;
+  // high nibbles of the bytes changed by the table, with their 16-entry rows
+  int shuffle_rows_ = -1;
+  unsigned char row_nibbles_[kMaxShuffleRows] = {};
+  alignas(16) unsigned char rows_[kMaxShuffleRows][16] = {};
+};
+
+/**
+ * =============================================================================
+ * Commands
+ * =============================================================================
+ */
+class Command {
+ public:
+  /**
+   * Modifies the field in place, returns true when it changed. The field a
+   * command is applied to is picked by ExecutionPlan. A command may resize
+   * the field: its storage comes from the per-batch arena of the calling
+   * thread (see LineScratch), so growing it does not go to the global heap
+   * @param field
+   */
+  virtual bool apply(std::pmr::string& field) = 0;
+  virtual int field() const = 0;
+  /**
+   * The command as given on the command line, e.g. 1:u
+   */
+  virtual std::string describe() const = 0;
+  /**
+   * Commands that translate every byte on its own compose that translation on
+   * top of map and return true, so that they can be fused with their neighbours
+   * @param map
+   */
+  virtual bool compose(ByteMap& /*map*/) const { return false; }
+  /**
+   * Whether the field keeps its length, which lets --in-place rewrite the file
+   * through a writable mapping. Only commands that never resize the field
+   * override it, any other one gets the temporary file
+   */
+  virtual bool preserves_length() const { return false; }
+  virtual ~Command() = default;
+};
+
+/**
+ * Makes a string lower case for a specific string
+ */
+class LowerCaseCommand : public Command {
+ public:
+  explicit LowerCaseCommand(int n) : field_(n) {}
+  ~LowerCaseCommand() override = default;
+  bool apply(std::pmr::string& field) override;
+  int field() const override { return field_; }
+  std::string describe() const override { return std::to_string(field_) + ":u"; }
+  bool compose(ByteMap& map) const override {
+    map.then([](unsigned char c) { return tolower(c); });
+    return true;
+  }
+  bool preserves_length() const override { return true; }
+ private:
+  int field_;
+};
+
+/**
+ * Makes a string upper case for a specific string
+ */
+class UpperCaseCommand : public Command {
+ public:
+  explicit UpperCaseCommand(int n) : field_(n) {}
+  bool apply(std::pmr::string& field) override;
+  ~UpperCaseCommand() override = default;
+  int field() const override { return field_; }
+  std::string describe() const override { return std::to_string(field_) + ":U"; }
+  bool compose(ByteMap& map) const override {
+    map.then([](unsigned char c) { return toupper(c); });
+    return true;
+  }
+  bool preserves_length() const override { return true; }
+ private:
+  int field_;
+};
+
+/**
+ * Replaces characters with other ones for a specific string. Several pairs are
+ * replaced at once in a single pass through a translation table, so R with
+ * pairs ab and ba swaps a and b. When a character starts several pairs the
+ * first pair wins
+ */
+class ReplaceCommand : public Command {
+ public:
+  explicit ReplaceCommand(int n, char from, char to)
+      : ReplaceCommand(n, std::vector<std::pair<char, char>>{{from, to}}) {}
+  ReplaceCommand(int n, std::vector<std::pair<char, char>> pairs);
+  bool apply(std::pmr::string& field) override;
+  ~ReplaceCommand() override = default;
+  int field() const override { return field_; }
+  std::string describe() const override {
+    std::string result = std::to_string(field_) + ":R";
+    for (auto& pair : pairs_) {
+      result += pair.first;
+      result += pair.second;
+    }
+    return result;
+  }
+  bool compose(ByteMap& map) const override {
+    const ByteMap& replace = this->map_;
+    map.then([&replace](unsigned char c) { return replace.translate(c); });
+    return true;
+  }
+  bool preserves_length() const override { return true; }
+ private:
+  int field_;
+  std::vector<std::pair<char, char>> pairs_;
+  ByteMap map_;
+};
+
+/**
+ * =============================================================================
+ * Execution plan
+ * =============================================================================
+ */
+
+/**
+ * Commands compiled once into per-field steps. Only the fields that have
+ * commands are visited for a line, and all the commands of a field are run
+ * back to back in the order they were given on the command line. Consecutive
+ * commands of a field that translate single bytes are fused into one ByteMap
+ */
+class ExecutionPlan {
+ public:
+  /**
+   * Either a fused translation table or a command that could not be fused
+   */
+  struct FieldOp {
+    const ByteMap* map;
+    Command* command;
+    // indices in commands() of the commands this op runs
+    std::vector<size_t> sources;
+  };
+  struct FieldStep {
+    int field;
+    std::vector<FieldOp> ops;
+  };
+  explicit ExecutionPlan(std::vector<std::unique_ptr<Command>> commands);
+  const std::vector<FieldStep>& steps() const { return steps_; }
+  const std::vector<std::unique_ptr<Command>>& commands() const { return commands_; }
+  /**
+   * Number of leading fields a line has to be split into, the fields after them
+   * are never touched by a command
+   */
+  size_t field_count() const { return steps_.empty() ? 0 : steps_.back().field + 1; }
+  bool preserves_length() const {
+    return std::all_of(commands_.begin(), commands_.end(), [](auto& command) { return command->preserves_length(); });
+  }
+ private:
+  void fuse(FieldStep& step, const std::vector<size_t>& commands);
+  std::vector<std::unique_ptr<Command>> commands_;
+  std::vector<std::unique_ptr<ByteMap>> maps_;
+  // sorted by field
+  std::vector<FieldStep> steps_;
+};
+
+/**
+ * =============================================================================
+ * Statistics
+ * =============================================================================
+ */
+
+/**
+ * Counters collected with --stats. Every thread counts into its own instance
+ * (LocalStats), which is merged into the total of the run (SharedStats) when
+ * the thread is done, so the hot path never shares a cache line. Code that is
+ * given a null RunStats counts nothing and takes no timings
+ */
+struct RunStats {
+  uint64_t bytes_read = 0;
+  // part of bytes_read that was mapped: its reading happens in page faults,
+  // inside the tokenize and apply times, so read_ns does not cover it
+  uint64_t bytes_mapped = 0;
+  uint64_t lines_read = 0;
+  uint64_t lines_changed = 0;
+  uint64_t bytes_written = 0;
+  uint64_t read_ns = 0;
+  uint64_t tokenize_ns = 0;
+  uint64_t apply_ns = 0;
+  uint64_t write_ns = 0;
+  // indexed like ExecutionPlan::commands()
+  std::vector<uint64_t> command_calls;
+  std::vector<uint64_t> command_bytes;
+  void count_command(size_t idx, size_t bytes);
+  void merge(const RunStats& other);
+};
+
+/**
+ * Counters of a whole run, owned by the run and merged into by its threads
+ */
+class SharedStats {
+ public:
+  void merge(const RunStats& stats) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->total_.merge(stats);
+  }
+  /**
+   * The merged counters, once the threads of the run are done
+   */
+  const RunStats& total() const { return this->total_; }
+ private:
+  std::mutex mutex_;
+  RunStats total_;
+};
+
+/**
+ * Counters of one thread, merged into shared when they go out of scope. get()
+ * is null when shared is, so that nothing is counted without --stats
+ */
+class LocalStats {
+ public:
+  explicit LocalStats(SharedStats* shared) : shared_(shared) {}
+  ~LocalStats() {
+    if (this->shared_ != nullptr) {
+      this->shared_->merge(this->stats_);
+    }
+  }
+  LocalStats(const LocalStats&) = delete;
+  LocalStats& operator=(const LocalStats&) = delete;
+  RunStats* get() { return this->shared_ != nullptr ? &this->stats_ : nullptr; }
+ private:
+  SharedStats* shared_;
+  RunStats stats_;
+};
+
+uint64_t now_ns();
+
+/**
+ * =============================================================================
+ * Line handling
+ * =============================================================================
+ */
+
+/**
+ * Finds delimiter positions in a buffer 64 bytes at a time. The bitmask of the
+ * current block is kept between calls, so walking all the delimiters of a
+ * block costs one vector compare plus a count-trailing-zeros per delimiter
+ */
+class DelimiterScanner {
+ public:
+  DelimiterScanner(std::string_view data, char delim) : data_(data), delim_(delim) {}
+  size_t find(size_t from);
+ private:
+  uint64_t load_mask(size_t block) const;
+  std::string_view data_;
+  char delim_;
+  size_t block_ = std::string_view::npos;
+  uint64_t mask_ = 0;
+};
+
+/**
+ * Finds two delimiters in a row, i.e. an empty field, 64 bytes at a time
+ * @param data
+ * @param delim
+ * @return the position of the first of them, npos when there is none
+ */
+size_t find_delimiter_pair(std::string_view data, char delim);
+
+/**
+ * Splits a string by a delim character. The produced fields are views into str,
+ * so no field is copied; out is appended to and may be reused across calls.
+ * Scanning stops once max_fields fields are found, the rest of the string after
+ * the delimiter that ends the last field is returned untouched
+ * @param str
+ * @param delim
+ * @param out
+ * @param max_fields
+ * @return the part of str that was not split
+ */
+std::string_view tokenize(
+    std::string_view str,
+    char delim,
+    std::vector<std::string_view>& out,
+    size_t max_fields = std::string_view::npos);
+
+/**
+ * Parses commands as specified in the requirements. Throws std::invalid_argument
+ * if finds a wrong command
+ * @param arguments one command each, e.g. 1:u
+ * @param commands
+ */
+void parse_commands(const std::vector<std::string>& arguments, std::vector<std::unique_ptr<Command>>& commands);
+
+/**
+ * Per-thread buffers used to process lines. The vectors of views are cleared
+ * but never freed between lines. Field storage is allocated from a monotonic
+ * arena that is rewound after every batch (a chunk or a block) by reset_batch;
+ * the arena starts on a buffer of its own, so a batch that fits in it performs
+ * no heap allocation and threads never contend in malloc
+ */
+struct LineScratch {
+  explicit LineScratch(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+      : initial(new char[kInitialArenaSize]),
+        arena(initial.get(), kInitialArenaSize, upstream),
+        owned(&arena) {}
+  LineScratch(const LineScratch&) = delete;
+  LineScratch& operator=(const LineScratch&) = delete;
+  /**
+   * Drops the storage of the current batch and rewinds the arena to its start.
+   * owned is replaced rather than cleared because its own array lives in the
+   * arena too; both come from the initial buffer again in the next batch, so
+   * this allocates nothing (see tests/FileManipulator_alloc_test.cpp)
+   */
+  void reset_batch() {
+    owned = std::pmr::vector<std::pmr::string>(&arena);
+    arena.release();
+  }
+  static const size_t kInitialArenaSize = 256 << 10;
+  std::unique_ptr<char[]> initial;
+  std::pmr::monotonic_buffer_resource arena;
+  // fields of the line, views into it
+  std::vector<std::string_view> fields;
+  // indices of the fields changed by commands, ascending, their new content
+  // is in owned
+  std::vector<size_t> changed_fields;
+  // storage of the fields modified by commands, indexed by field
+  std::pmr::vector<std::pmr::string> owned;
+  // the part of the line after the last field a command refers to
+  std::string_view tail;
+  // counters of the owning thread, set by it, null unless --stats is given
+  RunStats* stats = nullptr;
+};
+
+/**
+ * Applies commands as specified in the requirements.
+ * Returns changed flag together with the indices of the changed fields in
+ * scratch, only those are materialized in owned, the rest stay views into line.
+ * The line is split only up to the last field a command refers to, what
+ * follows is returned in tail as is, without its leading delimiter
+ * @param line
+ * @param plan
+ * @param changed
+ * @param scratch
+ */
+void apply_commands(std::string_view line, const ExecutionPlan& plan, bool& changed, LineScratch& scratch);
+
+/**
+ * =============================================================================
+ * Input
+ * =============================================================================
+ */
+
+/**
+ * Opens the input, "-" stands for the standard input. Throws std::system_error
+ * if the file can not be opened
+ * @param file_path
+ * @return file descriptor
+ */
+int open_input(const std::string& file_path);
+
+/**
+ * Read-only view over the whole input. Regular files are memory mapped with a
+ * sequential access hint, so lines are handed to the commands straight from the
+ * page cache. Anything that can not be mapped (pipes, character devices, empty
+ * files) is left unmapped and has to be streamed with a BlockReader
+ */
+class InputBuffer {
+ public:
+  explicit InputBuffer(int fd);
+  ~InputBuffer();
+  InputBuffer(const InputBuffer&) = delete;
+  InputBuffer& operator=(const InputBuffer&) = delete;
+  bool mapped() const { return mapping_ != MAP_FAILED; }
+  std::string_view data() const { return {data_, size_}; }
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  void* mapping_ = MAP_FAILED;
+};
+
+/**
+ * Calls f for every line of data, without the trailing new line character.
+ * Same framing as std::getline: a last line without new line is still reported.
+ * @param data
+ * @param f
+ */
+template <typename F>
+void for_each_line(std::string_view data, F&& f) {
+  DelimiterScanner scanner(data, '\n');
+  size_t pos = 0;
+  while (pos < data.size()) {
+    size_t line_end = scanner.find(pos);
+    f(data.substr(pos, line_end - pos));
+    pos = line_end + 1;
+  }
+}
+
+/**
+ * Source of raw input bytes for BlockReader
+ */
+class ByteSource {
+ public:
+  virtual ~ByteSource() = default;
+  /**
+   * Reads at most size bytes into data, returns 0 at the end of the input.
+   * Throws std::system_error on a read error
+   * @param data
+   * @param size
+   */
+  virtual size_t read(char* data, size_t size) = 0;
+};
+
+/**
+ * Picks the reader for a stream
+ * @param fd
+ * @param io_uring prefer io_uring, falls back to read(2) when it is not available
+ */
+std::unique_ptr<ByteSource> open_source(int fd, bool io_uring);
+
+/**
+ * Reads an input stream in blocks of whole lines. A block is filled up to
+ * block_size bytes from the source and cut after its last new line; the partial
+ * line is carried over to the next block. A line longer than block_size makes
+ * its block grow until the line is complete
+ */
+class BlockReader {
+ public:
+  /**
+   * @param source
+   * @param block_size
+   * @param stats counters of the calling thread, may be null
+   */
+  BlockReader(ByteSource& source, size_t block_size, RunStats* stats = nullptr)
+      : source_(source), block_size_(block_size), stats_(stats) {}
+  /**
+   * Replaces the content of block with the next lines, returns false at the end of the input
+   * @param block
+   */
+  bool next(std::string& block);
+ private:
+  ByteSource& source_;
+  size_t block_size_;
+  RunStats* stats_;
+  std::string carry_;
+  bool eof_ = false;
+};
+
+/**
+ * =============================================================================
+ * Output
+ * =============================================================================
+ */
+
+/**
+ * Buffered writer on top of a file descriptor, replacing std::cout so that a
+ * changed line costs a few memcpy calls instead of a flushing std::endl. Slices
+ * that do not fit the buffer are passed to writev together with the buffered
+ * bytes instead of being copied. Long slices of the source, the mapped input,
+ * are copied by the kernel from the input file. Write errors throw
+ * std::system_error; the destructor flushes what is left but can not report
+ * an error, so the output must be flushed explicitly when it is complete
+ */
+class OutputWriter {
+ public:
+  explicit OutputWriter(int fd, size_t flush_lines = 0, size_t capacity = 1 << 20)
+      : fd_(fd), flush_lines_(flush_lines), buffer_(capacity) {}
+  ~OutputWriter() {
+    try {
+      flush();
+    } catch (const std::system_error&) {
+    }
+  }
+  OutputWriter(const OutputWriter&) = delete;
+  OutputWriter& operator=(const OutputWriter&) = delete;
+  void write(std::string_view bytes);
+  /**
+   * Writes whole lines made ahead of the writer, e.g. by the workers of
+   * process_parallel, counting them towards the flush interval
+   * @param bytes
+   */
+  void write_lines(std::string_view bytes);
+  /**
+   * Tells that data is a mapping of the file fd, so that long slices of it are
+   * copied with copy_file_range (to a regular file) or sendfile (to anything
+   * else, a pipe included) instead of passing through user space
+   * @param fd
+   * @param data
+   */
+  void set_source(int fd, std::string_view data);
+  /**
+   * Counts the bytes written and the time spent writing into stats
+   * @param stats counters of the calling thread, may be null
+   */
+  void set_stats(RunStats* stats) { this->stats_ = stats; }
+  void put(char c);
+  /**
+   * Terminates the current line and flushes if the flush interval is reached
+   */
+  void end_line();
+  void flush();
+ private:
+  void write_all(struct iovec* iov, int count);
+  bool copy_from_source(std::string_view bytes);
+  static const size_t kMinCopy = 64 << 10;
+  int fd_;
+  int source_fd_ = -1;
+  std::string_view source_;
+  bool regular_output_ = false;
+  size_t flush_lines_;
+  size_t pending_lines_ = 0;
+  std::vector<char> buffer_;
+  size_t used_ = 0;
+  RunStats* stats_ = nullptr;
+};
+
+/**
+ * =============================================================================
+ * Processing
+ * =============================================================================
+ */
+
+/**
+ * Output sink appending into a string, used for chunks that are processed
+ * ahead of the writer
+ */
+class StringSink {
+ public:
+  explicit StringSink(std::string& out) : out_(out) {}
+  void write(std::string_view bytes) { out_.append(bytes); }
+  void put(char c) { out_.push_back(c); }
+  void end_line() { out_.push_back('\n'); }
+ private:
+  std::string& out_;
+};
+
+/**
+ * Writes line, last passed to apply_commands, with its changed fields. The
+ * untouched fields are written as slices of the input line: a run of them is
+ * contiguous there together with the delimiters in between, unless an empty
+ * field was skipped inside it, so it costs one write however long it is. The
+ * empty fields of the tail are dropped as well, so that the output does not
+ * depend on how far the line was split; a tail without them is one slice.
+ * With verbatim the empty fields are kept as well and only the changed fields
+ * differ from line
+ * @param line
+ * @param scratch
+ * @param sink
+ * @param verbatim
+ */
+template <typename Sink>
+void write_line(std::string_view line, const LineScratch& scratch, Sink& sink, bool verbatim) {
+  const std::vector<std::string_view>& fields = scratch.fields;
+  if (verbatim) {
+    const char* pos = line.data();
+    for (size_t idx : scratch.changed_fields) {
+      sink.write(std::string_view(pos, fields[idx].data() - pos));
+      sink.write(scratch.owned[idx]);
+      pos = fields[idx].data() + fields[idx].size();
+    }
+    sink.write(std::string_view(pos, line.data() + line.size() - pos));
+    return;
+  }
+  // the slice of the line that is not written yet
+  const char* begin = nullptr;
+  const char* end = nullptr;
+  auto write_pending = [&]() {
+    if (begin != nullptr) {
+      sink.write(std::string_view(begin, end - begin));
+      begin = nullptr;
+    }
+  };
+  // adds an untouched piece of the line, not empty, to the slice when it
+  // follows it after a single delimiter
+  auto write_untouched = [&](std::string_view original, bool first) {
+    if (begin != nullptr && original.data() == end + 1) {
+      end = original.data() + original.size();
+      return;
+    }
+    write_pending();
+    if (!first) {
+      sink.put('\t');
+    }
+    begin = original.data();
+    end = begin + original.size();
+  };
+  auto next_changed = scratch.changed_fields.begin();
+  for (size_t idx = 0; idx < fields.size(); ++idx) {
+    if (next_changed == scratch.changed_fields.end() || *next_changed != idx) {
+      write_untouched(fields[idx], idx == 0);
+      continue;
+    }
+    write_pending();
+    // print tab only when not the first field
+    if (idx > 0) {
+      sink.put('\t');
+    }
+    sink.write(scratch.owned[idx]);
+    ++next_changed;
+  }
+  // the tail follows the last field after a delimiter, it is cut at the runs
+  // of delimiters that enclose empty fields
+  std::string_view tail = scratch.tail;
+  for (;;) {
+    tail.remove_prefix(std::min(tail.find_first_not_of('\t'), tail.size()));
+    if (tail.empty()) {
+      break;
+    }
+    size_t run = find_delimiter_pair(tail, '\t');
+    std::string_view piece = tail.substr(0, run);
+    if (run == std::string_view::npos && piece.back() == '\t') {
+      piece.remove_suffix(1);
+    }
+    write_untouched(piece, fields.empty());
+    tail.remove_prefix(piece.size());
+  }
+  write_pending();
+}
+
+/**
+ * Applies the plan to every line of data and writes the changed lines to sink.
+ * data is one batch: the field storage of scratch is released once all of its
+ * lines are written. With all_lines every line is written, the unchanged ones
+ * as they were read, and the changed ones keep their empty fields, so that the
+ * output differs from data only in the changed fields. Runs of unchanged lines
+ * are written as one slice of data
+ * @param data
+ * @param plan
+ * @param scratch buffers of the calling thread
+ * @param sink
+ * @param all_lines
+ */
+template <typename Sink>
+void process_lines(
+    std::string_view data,
+    const ExecutionPlan& plan,
+    LineScratch& scratch,
+    Sink& sink,
+    bool all_lines = false
+    ) {
+  RunStats* stats = scratch.stats;
+  if (stats != nullptr) {
+    stats->bytes_read += data.size();
+  }
+  // start of the unchanged lines not written yet, with all_lines
+  const char* run = data.data();
+  for_each_line(data, [&](std::string_view line) {
+    bool changed = false;
+    apply_commands(line, plan, changed, scratch);
+    if (stats != nullptr) {
+      ++stats->lines_read;
+      stats->lines_changed += changed;
+    }
+    if (!changed) {
+      return;
+    }
+    // at least one field had changed, thus print out the full string
+    if (all_lines) {
+      sink.write(std::string_view(run, line.data() - run));
+      write_line(line, scratch, sink, true);
+      run = line.data() + line.size();
+      // the last line may have no new line character
+      if (run == data.data() + data.size()) {
+        return;
+      }
+      ++run;
+    } else {
+      write_line(line, scratch, sink, false);
+    }
+    sink.end_line();
+  });
+  if (all_lines) {
+    sink.write(std::string_view(run, data.data() + data.size() - run));
+  }
+  scratch.reset_batch();
+}
+
+/**
+ * Processes data on a pool of jobs threads. Chunks are claimed in order and
+ * their output is kept in a reorder window of 2 * jobs slots, so that workers
+ * never run further ahead of the writer than that, and the output is written
+ * by the calling thread in the original order. When writing fails the
+ * workers stop after their current chunk and the error is thrown once they
+ * are joined
+ * @param data
+ * @param plan
+ * @param jobs
+ * @param output
+ * @param all_lines see process_lines
+ * @param stats counters of the run, may be null
+ */
+void process_parallel(
+    std::string_view data,
+    const ExecutionPlan& plan,
+    unsigned jobs,
+    OutputWriter& output,
+    bool all_lines = false,
+    SharedStats* stats = nullptr);
+
+}  // namespace filemanipulator
+
+#endif
@@ -1,111 +1,88 @@
+#include "filemanipulator.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 #include <string>
-#include <optional>
+#include <thread>
 #include <vector>
-#include <fstream>
-#include <memory>
+#include <glob.h>
 
 /**
- * =============================================================================
- * Commands
- * =============================================================================
- */
-class Command {
- public:
-  virtual std::optional<std::string> apply(int field, std::string& str) = 0;
-  virtual ~Command() = default;
-};
-
-/**
- * Makes a string upper case for a specific string
- */
-class LowerCaseCommand : public Command {
- public:
-  explicit LowerCaseCommand(int n) : field_(n) {}
-  ~LowerCaseCommand() override = default;
-  std::optional<std::string> apply(int field, std::string& str) override;
- private:
-  int field_;
-};
-std::optional<std::string> LowerCaseCommand::apply(int field, std::string& str) {
-  if (field != this->field_) {
-    return {};
-  }
-  std::string result;
-  for(auto& c : str) {
-     result.push_back(toupper(c));
-  }
-  // a string copy is made
-  return result;
-}
-
-/**
- * Makes a string upper case for a specific string
- */
-class UpperCaseCommand : public Command {
- public:
-  explicit UpperCaseCommand(int n) : field_(n) {}
-  std::optional<std::string> apply(int field, std::string& str) override;
-  ~UpperCaseCommand() override = default;
- private:
-  int field_;
-};
-std::optional<std::string> UpperCaseCommand::apply(int field, std::string& str) {
-  if (field != this->field_) {
-    return {};
-  }
-  std::string result;
-  for(auto& c : str) {
-     result.push_back(tolower(c));
-  }
-  // a string copy is made
-  return result;
-}
-
-/**
- * Makes a string upper case for a specific string
- */
-class ReplaceCommand : public Command {
- public:
-  explicit ReplaceCommand(int n, char from, char to)
-      : field_(n), from_(from), to_(to) {}
-  std::optional<std::string> apply(int field, std::string& str) override;
-  ~ReplaceCommand() override = default;
- private:
-  int field_;
-  char from_;
-  char to_;
-};
-std::optional<std::string> ReplaceCommand::apply(int field, std::string& str) {
-  if (field != this->field_) {
-    return {};
-  }
-  std::string result;
-  for(auto& c : str) {
-     if(c == this->from_) {
-       result.push_back(this->from_);
-     } else {
-       result.push_back(c);
-     }
-  }
-  // a string copy is made
-  return result;
-}
-
-/**
- * =============================================================================
- * End Commands
- * =============================================================================
+ * FileManipulator command line, the work is done by libfilemanipulator
  */
 
+// upper bound of -j, a larger count is taken for a typo
+const long kMaxJobs = 1024;
+// upper bound of --max-open, more than any open files limit in practice
+const long kMaxOpen = 65536;
 
 void print_help_and_exit() {
   std::string help_line = R"(
   FileManipulator modifies line fields in the file
-  <file_path>     - path to the file for manipulation
+  FileManipulator [options] [file_path...] [commands]
+  <file_path>     - path to the file for manipulation, "-" or no path reads
+                    the standard input. Several files are processed one per
+                    thread (see -j), their outputs follow each other in the
+                    order of the paths. A quoted pattern such as "*.tsv" is
+                    expanded by the program
+  --files-from F  - process the files listed in F, one path or pattern per
+                    line, after the ones given as arguments; "-" reads the
+                    list from the standard input
+  --output-suffix S - write the output of every file into the file path with
+                    S appended instead of the standard output
+  --max-open N    - keep at most N input files open while their outputs wait
+                    for the files before them, 1 to 65536, 64 by default
+  --flush-lines N - flush the output after every N changed lines, by default
+                    the output is flushed only when its buffer is full. When
+                    the lines are transformed ahead of the writer (-j N,
+                    --pipeline, batches, --connect) every line written
+                    counts, unchanged ones included with --all-lines
+  -j N            - process the file on N threads, 0 picks the number of
+                    CPUs, at most 1024; the output order is kept
+  --pipeline      - read, transform and write on separate threads, reading
+                    the file in blocks instead of mapping it; -j N sets the
+                    number of transform threads. Used for the standard
+                    input and pipes when -j N is given
+  --io-uring      - read regular files in blocks with several io_uring reads
+                    in flight instead of mapping them, falls back to read(2)
+                    when the kernel has no io_uring
+  --stats         - report bytes, lines, time per stage and per command
+                    counters to stderr at exit (stage times are summed
+                    over the worker threads; a mapped file has no read
+                    time, its page faults fall into tokenize and apply)
+  --all-lines     - print every line, the unchanged ones as they were read, so
+                    that the output is the whole file with the commands
+                    applied; empty fields of the changed lines are kept
+  --in-place      - rewrite the file with the commands applied instead of
+                    printing the changed lines. With commands that keep the
+                    field length the changed fields are written into the
+                    file directly, which is not atomic: an interrupted run
+                    leaves part of the file rewritten. Otherwise a temporary
+                    file is written next to it and renamed over it
+  --atomic        - with --in-place always write a temporary file and rename
+                    it over the file, keeping its owner and mode, so that
+                    an interrupted run leaves the old file. A symbolic link
+                    is followed; a file with several hard links is refused
+  --daemon SOCKET - serve requests on the Unix socket SOCKET until killed, on
+                    -j N threads that serve a connection each; the commands
+                    come with the requests and are compiled once. A line
+                    is limited to 64 MiB. --stats reports every connection
+                    when it closes
+  --connect SOCKET - have the daemon at SOCKET transform the files, one
+                    request each; only --all-lines, --flush-lines and
+                    --stats apply, the latter reports request latencies
+  --repeat N      - with --connect send every file N times, writing its
+                    output each time
   [N:u]           - change every line's field N to lower case letters
   [N:U]           - change every line's field N to upper case letters
   [N:RAB]         - replace a character A to B in every line's field N
+  [N:RABCD...]    - replace A to B, C to D and so on in a single pass
 
   Note: if N does not represent a valid field, the command is not applied
 )";
@@ -115,123 +92,180 @@ void print_help_and_exit() {
 }
 
 /**
- * Splits a string by a delim character
- * @param str
- * @param delim
- * @param out
+ * Parses the value of option as a whole decimal number between min and max.
+ * Exits the program if it is anything else, e.g. negative or not a number
+ * @param option
+ * @param value
+ * @param min
+ * @param max std::numeric_limits<long>::max() for no bound
  */
-void tokenize(std::string const &str, const char delim, std::vector<std::string> &out)
-{
-	size_t start;
-	size_t end = 0;
-
-	while ((start = str.find_first_not_of(delim, end)) != std::string::npos)
-	{
-		end = str.find(delim, start);
-		out.push_back(str.substr(start, end - start));
-	}
+long parse_count(const std::string& option, const char* value, long min, long max) {
+  char* end = nullptr;
+  errno = 0;
+  long count = std::strtol(value, &end, 10);
+  if (end == value || *end != '\0' || errno == ERANGE || count < min || count > max) {
+    std::cerr << "Warning: unable to parse option [" << option << ' ' << value << "], expected ";
+    if (max == std::numeric_limits<long>::max()) {
+      std::cerr << "a number of at least " << min << std::endl;
+    } else {
+      std::cerr << min << " to " << max << std::endl;
+    }
+    print_help_and_exit();
+  }
+  return count;
 }
 
 /**
- * Parses commands as specified in the requirements. Exits the program if finds a wrong command
+ * What the command line asks for besides the options of the library
+ */
+struct CommandLine {
+  filemanipulator::Options options;
+  std::string files_from;
+  std::string daemon_socket;
+  std::string connect_socket;
+  unsigned repeat = 1;
+};
+
+/**
+ * Parses the options preceding the file path. Exits the program if finds a wrong option
  * @param argc
  * @param argv
- * @param commands
+ * @param command_line
+ * @return index of the file path argument
  */
-void parse_commands(int argc, char* const* argv, std::vector<std::unique_ptr<Command>>& commands) {
-  for(int idx = 2; idx < argc; ++idx) {
-    std::string cmd(argv[idx]);
-    std::vector<std::string> parts;
-    tokenize(cmd, ':', parts);
-
-    if (parts.size() != 2) {
-      std::cerr << "Warning: unable to parse argument [" << cmd << "]" << std::endl;
-      print_help_and_exit();
+int parse_options(int argc, char* const* argv, CommandLine& command_line) {
+  filemanipulator::Options& options = command_line.options;
+  int idx = 1;
+  for(; idx < argc; ++idx) {
+    std::string option(argv[idx]);
+    if (option.size() < 2 || option[0] != '-') {
+      break;
     }
-    int field = std::stoi(parts[0]);
-    if (parts[1] == "u") {
-      std::unique_ptr<Command> lower_case_command (new LowerCaseCommand(field));
-      commands.push_back(std::move(lower_case_command));
-    } else if (parts[1] == "U") {
-      std::unique_ptr<Command> upper_case_command (new UpperCaseCommand(field));
-      commands.push_back(std::move(upper_case_command));
+    if (option == "--flush-lines" && idx + 1 < argc) {
+      options.flush_lines = parse_count(option, argv[++idx], 0, std::numeric_limits<long>::max());
+    } else if (option == "--pipeline") {
+      options.pipeline = true;
+    } else if (option == "--io-uring") {
+      options.io_uring = true;
+    } else if (option == "--stats") {
+      options.stats = true;
+    } else if (option == "--in-place") {
+      options.in_place = true;
+    } else if (option == "--atomic") {
+      options.atomic = true;
+    } else if (option == "--all-lines") {
+      options.all_lines = true;
+    } else if (option == "--files-from" && idx + 1 < argc) {
+      command_line.files_from = argv[++idx];
+    } else if (option == "--daemon" && idx + 1 < argc) {
+      command_line.daemon_socket = argv[++idx];
+    } else if (option == "--connect" && idx + 1 < argc) {
+      command_line.connect_socket = argv[++idx];
+    } else if (option == "--repeat" && idx + 1 < argc) {
+      command_line.repeat = parse_count(option, argv[++idx], 1, std::numeric_limits<unsigned>::max());
+    } else if (option == "--output-suffix" && idx + 1 < argc) {
+      options.output_suffix = argv[++idx];
+    } else if (option == "--max-open" && idx + 1 < argc) {
+      options.max_open = parse_count(option, argv[++idx], 1, kMaxOpen);
+    } else if ((option == "-j" || option == "--jobs") && idx + 1 < argc) {
+      long jobs = parse_count(option, argv[++idx], 0, kMaxJobs);
+      options.jobs = jobs != 0 ? jobs : std::max(1u, std::thread::hardware_concurrency());
     } else {
-      // replace parsing
-      if (parts[1].size() != 3) {
-        std::cerr << "Warning: unable to parse argument [" << cmd << "]" << std::endl;
-        print_help_and_exit();
-      }
-      // must start with 'R'
-      if (parts[1][0] != 'R') {
-        std::cerr << "Warning: unable to parse argument [" << cmd << "]" << std::endl;
-        print_help_and_exit();
-      }
-      std::__1::unique_ptr<Command> replace_command (
-          new ReplaceCommand(field, parts[1][1], parts[1][2])
-      );
-      commands.push_back(std::move(replace_command));
+      std::cerr << "Warning: unable to parse option [" << option << "]" << std::endl;
+      print_help_and_exit();
     }
   }
+  // the daemon takes its commands from the requests
+  if (idx >= argc && command_line.daemon_socket.empty()) {
+    print_help_and_exit();
+  }
+  return idx;
 }
 
 /**
- * Applies commands as specified in the requirements.
- * Returns changed flag together with the modified fileds
- * @param line
- * @param commands
- * @param changed
- * @param modified
+ * Tells whether an argument is a command (N:...) rather than a file path
+ * @param arg
  */
-void apply_commands(
-    std::string& line,
-    std::vector<std::unique_ptr<Command>>& commands,
-    bool& changed,
-    std::vector<std::string>& modified
-    ) {
-  std::vector<std::string> fields;
-  tokenize(line, '\t', fields);
-  for(std::vector<std::string>::size_type idx = 0; idx != fields.size(); idx++) {
-    std::string& str = fields[idx];
-    for(auto& command : commands) {
-      std::optional<std::string> modified_str = *command->apply(idx, str);
-      if (modified_str.has_value()) {
-        str = modified_str.value();
-        changed = true;
-      }
-    }
-    modified.push_back(str);
+bool is_command_argument(const char* arg) {
+  if (!std::isdigit(static_cast<unsigned char>(*arg))) {
+    return false;
   }
-
+  while (std::isdigit(static_cast<unsigned char>(*arg))) {
+    ++arg;
+  }
+  return *arg == ':';
 }
 
-int main(int argc, char**argv) {
-  if (argc < 2) {
-    print_help_and_exit();
+/**
+ * Adds pattern to paths, expanded when it contains wildcards and matches files
+ * @param pattern
+ * @param paths
+ */
+void expand_path(const std::string& pattern, std::vector<std::string>& paths) {
+  glob_t matches{};
+  if (pattern.find_first_of("*?[") != std::string::npos
+      && glob(pattern.c_str(), 0, nullptr, &matches) == 0) {
+    paths.insert(paths.end(), matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+  } else {
+    paths.push_back(pattern);
   }
-  std::string file_path(argv[1]);
-
-  std::vector<std::unique_ptr<Command>> commands;
-  parse_commands(argc, argv, commands);
+  globfree(&matches);
+}
 
-  std::ifstream infile(file_path);
+/**
+ * Adds the paths listed in list_path, one per line, to paths. Exits the program
+ * if the list can not be read
+ * @param list_path "-" reads the standard input
+ * @param paths
+ */
+void read_file_list(const std::string& list_path, std::vector<std::string>& paths) {
+  std::ifstream file;
+  if (list_path != "-") {
+    file.open(list_path);
+    if (!file) {
+      std::cerr << "Error: unable to open file list [" << list_path << "]" << std::endl;
+      std::exit(1);
+    }
+  }
+  std::istream& list = list_path == "-" ? std::cin : file;
   std::string line;
-  while (std::getline(infile, line)) {
-    std::vector<std::string> modified;
-    bool changed;
-    apply_commands(line, commands, changed, modified);
-
-    // at least one field had changed, thus print out the full string
-    if (changed) {
-      for(std::vector<std::string>::size_type idx = 0; idx != modified.size(); idx++) {
-        std::cout << modified[idx];
-        // print tab only when not the last field
-        if (idx < modified.size() - 1) {
-          std::cout << '\t';
-        }
-      }
-      std::cout << std::endl;
+  while (std::getline(list, line)) {
+    if (!line.empty()) {
+      expand_path(line, paths);
     }
   }
+}
+
+int main(int argc, char**argv) {
+  std::ios::sync_with_stdio(false);
+  CommandLine command_line;
+  int file_arg = parse_options(argc, argv, command_line);
+  if (!command_line.daemon_socket.empty()) {
+    return filemanipulator::serve(command_line.daemon_socket, command_line.options);
+  }
+  // the paths are followed by the commands, without a path the commands
+  // follow the options directly
+  std::vector<std::string> paths;
+  int first_command = file_arg;
+  while (first_command < argc && !is_command_argument(argv[first_command])) {
+    expand_path(argv[first_command++], paths);
+  }
+  if (!command_line.files_from.empty()) {
+    read_file_list(command_line.files_from, paths);
+  }
+  std::vector<std::string> commands(argv + first_command, argv + argc);
 
-  return 0;
+  try {
+    if (!command_line.connect_socket.empty()) {
+      return filemanipulator::run_remote(
+          command_line.connect_socket, paths, commands, command_line.options, command_line.repeat);
+    }
+    return filemanipulator::run(paths, commands, command_line.options);
+  } catch (const std::invalid_argument& e) {
+    std::cerr << "Warning: " << e.what() << std::endl;
+    print_help_and_exit();
+  } catch (const std::runtime_error& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
 }
@@ -0,0 +1,142 @@
+// the allocation counters replace the global operator new, so this test is
+// an executable of its own
+#include "filemanipulator_internal.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+namespace {
+
+std::atomic<size_t> allocations{0};
+
+void* allocate(size_t size, size_t alignment) {
+  ++allocations;
+  size = size == 0 ? 1 : size;
+  void* data = alignment <= alignof(std::max_align_t)
+      ? std::malloc(size)
+      : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+  if (data == nullptr) {
+    throw std::bad_alloc();
+  }
+  return data;
+}
+
+}  // namespace
+
+void* operator new(size_t size) { return allocate(size, alignof(std::max_align_t)); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocate(size, size_t(alignment)); }
+void operator delete(void* data) noexcept { std::free(data); }
+void operator delete(void* data, size_t) noexcept { std::free(data); }
+void operator delete(void* data, std::align_val_t) noexcept { std::free(data); }
+void operator delete(void* data, size_t, std::align_val_t) noexcept { std::free(data); }
+
+namespace filemanipulator {
+namespace {
+
+/**
+ * Sink that only counts what would be written, so that it allocates nothing
+ */
+class CountingSink {
+ public:
+  void write(std::string_view bytes) { bytes_ += bytes.size(); }
+  void put(char) { ++bytes_; }
+  void end_line() { ++bytes_; }
+  size_t bytes() const { return bytes_; }
+ private:
+  size_t bytes_ = 0;
+};
+
+/**
+ * lines lines of 6 fields, with field lengths from 1 to 60 so that the
+ * changed fields outgrow the small string buffer
+ */
+std::string make_lines(size_t lines) {
+  std::string input;
+  for (size_t line = 0; line < lines; ++line) {
+    for (size_t field = 0; field < 6; ++field) {
+      if (field != 0) {
+        input.push_back('\t');
+      }
+      size_t length = 1 + (line * 7 + field * 13) % 60;
+      for (size_t idx = 0; idx < length; ++idx) {
+        input.push_back("abcdefABCDEF"[(line + field + idx) % 12]);
+      }
+    }
+    input.push_back('\n');
+  }
+  return input;
+}
+
+ExecutionPlan make_plan(const std::vector<std::string>& arguments) {
+  std::vector<std::unique_ptr<Command>> commands;
+  parse_commands(arguments, commands);
+  return ExecutionPlan(std::move(commands));
+}
+
+/**
+ * Allocations made by process_lines over input as one batch
+ */
+size_t count_allocations(const ExecutionPlan& plan, LineScratch& scratch, std::string_view input, bool all_lines) {
+  CountingSink sink;
+  size_t before = allocations;
+  process_lines(input, plan, scratch, sink, all_lines);
+  return allocations - before;
+}
+
+bool check(bool ok, const std::string& what) {
+  if (!ok) {
+    std::cerr << "FAILED: " << what << std::endl;
+  }
+  return ok;
+}
+
+/**
+ * Once the scratch buffers have their capacity, a batch of 4N lines must not
+ * allocate more than a batch of N lines, i.e. nothing is allocated per line
+ */
+bool test_allocations_do_not_grow_with_lines(bool all_lines) {
+  const size_t lines = 1000;
+  const std::string small = make_lines(lines);
+  const std::string large = make_lines(4 * lines);
+  ExecutionPlan plan = make_plan({"0:u", "1:U", "2:Rab", "4:RaAbBcC", "5:u", "5:RAa"});
+  LineScratch scratch;
+  count_allocations(plan, scratch, large, all_lines);
+  size_t small_allocations = count_allocations(plan, scratch, small, all_lines);
+  size_t large_allocations = count_allocations(plan, scratch, large, all_lines);
+  std::string mode = all_lines ? " with all_lines" : "";
+  return check(small_allocations == 0, std::to_string(small_allocations) + " allocations for N lines" + mode)
+      & check(large_allocations == small_allocations,
+              std::to_string(large_allocations) + " allocations for 4N lines" + mode);
+}
+
+/**
+ * reset_batch rewinds the arena to its initial buffer after every batch, so
+ * later batches are served from it again
+ */
+bool test_batches_reuse_the_arena(bool all_lines) {
+  const std::string input = make_lines(500);
+  ExecutionPlan plan = make_plan({"1:U", "3:RabBA"});
+  LineScratch scratch;
+  count_allocations(plan, scratch, input, all_lines);
+  bool ok = true;
+  for (int batch = 0; batch < 8; ++batch) {
+    size_t count = count_allocations(plan, scratch, input, all_lines);
+    ok &= check(count == 0, std::to_string(count) + " allocations in batch " + std::to_string(batch));
+  }
+  return ok;
+}
+
+}  // namespace
+}  // namespace filemanipulator
+
+int main() {
+  using namespace filemanipulator;
+  bool ok = true;
+  for (bool all_lines : {false, true}) {
+    ok &= test_allocations_do_not_grow_with_lines(all_lines);
+    ok &= test_batches_reuse_the_arena(all_lines);
+  }
+  return ok ? 0 : 1;
+}
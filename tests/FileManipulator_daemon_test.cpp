@@ -0,0 +1,306 @@
+#include "filemanipulator.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * The daemon protocol spoken by hand against serve running on a thread:
+ * requests round trip on one connection, protocol errors get an error frame
+ * and close the connection, a line without end is refused past the frame
+ * limit, concurrent clients get their own output, and a file that is not a
+ * socket is not replaced
+ */
+
+namespace {
+
+/**
+ * One frame: a type byte, the payload length as a native uint32, the payload
+ */
+struct Frame {
+  char type = 0;
+  std::string payload;
+};
+
+bool send_all(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool send_frame(int fd, char type, const std::string& payload) {
+  char header[5];
+  uint32_t size = payload.size();
+  header[0] = type;
+  std::memcpy(header + 1, &size, sizeof(size));
+  return send_all(fd, header, sizeof(header)) && send_all(fd, payload.data(), payload.size());
+}
+
+bool receive_all(int fd, char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = recv(fd, data, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * Returns false at the end of the stream
+ */
+bool receive_frame(int fd, Frame& frame) {
+  char header[5];
+  uint32_t size;
+  if (!receive_all(fd, header, sizeof(header))) {
+    return false;
+  }
+  frame.type = header[0];
+  std::memcpy(&size, header + 1, sizeof(size));
+  frame.payload.resize(size);
+  return receive_all(fd, &frame.payload[0], size);
+}
+
+int connect_to(const std::string& socket_path) {
+  struct sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+  // the daemon thread may not be listening yet
+  for (int attempt = 0; attempt < 200; ++attempt) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0) {
+      return fd;
+    }
+    close(fd);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return -1;
+}
+
+std::string header(const std::vector<std::string>& commands, bool all_lines = false) {
+  std::string header(1, all_lines ? 'a' : 'c');
+  for (const std::string& command : commands) {
+    header.append(command);
+    header.push_back('\0');
+  }
+  return header;
+}
+
+/**
+ * What the library gives for input, to compare the daemon with
+ */
+std::string expected(const std::string& input, const std::vector<std::string>& commands, bool all_lines = false) {
+  filemanipulator::Transformer transformer(commands, all_lines);
+  std::string output;
+  auto sink = [&output](std::string_view bytes) { output.append(bytes); };
+  transformer.push(input, sink);
+  transformer.finish(sink);
+  return output;
+}
+
+/**
+ * Sends a request with input cut in frames of frame_size bytes and collects
+ * the response. Returns false if the response is not data frames and an end
+ * @param largest if not null, receives the size of the largest response frame
+ */
+bool request(int fd, const std::string& request_header, const std::string& input, size_t frame_size,
+             std::string& output, size_t* largest = nullptr) {
+  output.clear();
+  bool sent = send_frame(fd, 'H', request_header);
+  for (size_t pos = 0; sent && pos < input.size(); pos += frame_size) {
+    sent = send_frame(fd, 'D', input.substr(pos, frame_size));
+  }
+  if (!sent || !send_frame(fd, 'F', std::string())) {
+    return false;
+  }
+  Frame frame;
+  while (receive_frame(fd, frame)) {
+    if (frame.type == 'F') {
+      return true;
+    }
+    if (frame.type != 'D') {
+      return false;
+    }
+    if (largest != nullptr) {
+      *largest = std::max(*largest, frame.payload.size());
+    }
+    output += frame.payload;
+  }
+  return false;
+}
+
+bool check(bool condition, const std::string& what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+  }
+  return condition;
+}
+
+/**
+ * Lines of fields that differ per client, with empty fields and a last line
+ * without new line
+ */
+std::string make_input(unsigned client, size_t lines) {
+  std::string input;
+  for (size_t idx = 0; idx < lines; ++idx) {
+    input += "client" + std::to_string(client) + "\tline" + std::to_string(idx) + "\t\tabc\n";
+  }
+  input += "last\tline";
+  return input;
+}
+
+bool round_trip(const std::string& socket_path) {
+  int fd = connect_to(socket_path);
+  if (!check(fd >= 0, "round trip: connect")) {
+    return false;
+  }
+  bool ok = true;
+  std::string output;
+  const std::string input = make_input(0, 1000);
+  // requests one after another on one connection, lines cut across frames
+  for (size_t frame_size : {size_t(7), size_t(4096), input.size()}) {
+    ok &= check(request(fd, header({"1:U", "3:Rab"}), input, frame_size, output), "round trip: response");
+    ok &= check(output == expected(input, {"1:U", "3:Rab"}), "round trip: output");
+    ok &= check(request(fd, header({"0:u"}, true), input, frame_size, output), "round trip: all lines response");
+    ok &= check(output == expected(input, {"0:u"}, true), "round trip: all lines output");
+  }
+  ok &= check(request(fd, header({"1:U"}), std::string(), 1, output) && output.empty(), "round trip: empty request");
+  // an unchanged line of several frames comes back in frames of at most 1 MiB
+  const std::string long_line = std::string(3 << 20, 'x') + "\tabc\n";
+  size_t largest = 0;
+  ok &= check(request(fd, header({"0:Rab"}, true), long_line, 1 << 20, output, &largest), "long line: response");
+  ok &= check(output == long_line, "long line: output");
+  ok &= check(largest <= (1 << 20), "long line: frame of " + std::to_string(largest) + " bytes");
+  close(fd);
+  return ok;
+}
+
+/**
+ * Sends frames and expects an error frame, then the end of the connection
+ */
+bool expect_error(const std::string& socket_path, const std::vector<Frame>& frames, const std::string& what) {
+  int fd = connect_to(socket_path);
+  if (!check(fd >= 0, what + ": connect")) {
+    return false;
+  }
+  for (const Frame& frame : frames) {
+    // the daemon may close before the rest is sent
+    if (!send_frame(fd, frame.type, frame.payload)) {
+      break;
+    }
+  }
+  Frame frame;
+  bool ok = check(receive_frame(fd, frame) && frame.type == 'E' && !frame.payload.empty(), what + ": error frame");
+  ok &= check(!receive_frame(fd, frame), what + ": connection closed");
+  close(fd);
+  return ok;
+}
+
+bool protocol_errors(const std::string& socket_path) {
+  bool ok = true;
+  ok &= expect_error(socket_path, {{'D', "a\tb\n"}}, "data before header");
+  ok &= expect_error(socket_path, {{'H', ""}}, "empty header");
+  ok &= expect_error(socket_path, {{'H', header({"1:X"})}}, "bad command");
+  ok &= expect_error(socket_path, {{'H', header({"1:U"})}, {'H', header({"1:U"})}}, "header in a request");
+  // a line that never ends is refused once it passes the 64 MiB frame limit
+  std::vector<Frame> endless = {{'H', header({"1:U"})}};
+  for (int idx = 0; idx < 65; ++idx) {
+    endless.push_back({'D', std::string(1 << 20, 'x')});
+  }
+  ok &= expect_error(socket_path, endless, "endless line");
+  return ok;
+}
+
+bool concurrent_clients(const std::string& socket_path) {
+  const unsigned clients = 8;
+  std::atomic<unsigned> failed{0};
+  std::vector<std::thread> threads;
+  for (unsigned client = 0; client < clients; ++client) {
+    threads.emplace_back([&, client]() {
+      int fd = connect_to(socket_path);
+      if (fd < 0) {
+        ++failed;
+        return;
+      }
+      const std::string input = make_input(client, 2000 + client * 100);
+      const std::vector<std::string> commands = {std::to_string(client % 4) + ":U"};
+      std::string output;
+      for (int repeat = 0; repeat < 20; ++repeat) {
+        if (!request(fd, header(commands), input, 1000 + client, output) || output != expected(input, commands)) {
+          ++failed;
+          break;
+        }
+      }
+      close(fd);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return check(failed == 0, "concurrent clients: " + std::to_string(failed) + " failed");
+}
+
+/**
+ * serve refuses to replace a file that is not a socket
+ */
+bool keeps_regular_file(const std::string& directory) {
+  const std::string path = directory + "/data.tsv";
+  { std::ofstream(path) << "a\tb\n"; }
+  filemanipulator::Options options;
+  bool ok = check(filemanipulator::serve(path, options) == 1, "regular file: serve fails");
+  struct stat st{};
+  ok &= check(lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode), "regular file: kept");
+  unlink(path.c_str());
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  const char* temp = std::getenv("TMPDIR");
+  std::string directory = std::string(temp != nullptr && *temp != '\0' ? temp : "/tmp") + "/fm_daemon_XXXXXX";
+  if (mkdtemp(&directory[0]) == nullptr) {
+    std::cerr << "FAILED: unable to create a temporary directory" << std::endl;
+    return 1;
+  }
+  bool ok = keeps_regular_file(directory);
+  const std::string socket_path = directory + "/fm.sock";
+  filemanipulator::Options options;
+  options.jobs = 4;
+  // serve runs until the process exits
+  std::thread([socket_path, options]() { filemanipulator::serve(socket_path, options); }).detach();
+
+  ok &= round_trip(socket_path);
+  ok &= protocol_errors(socket_path);
+  ok &= concurrent_clients(socket_path);
+  unlink(socket_path.c_str());
+  rmdir(directory.c_str());
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/**
+ * FileManipulator_generate is reproducible: the same seed and options give
+ * the same bytes, another seed gives another file. Run with the path of the
+ * generator as the argument
+ */
+
+namespace {
+
+std::string read_file(const std::string& path) {
+  std::ostringstream content;
+  content << std::ifstream(path, std::ios::binary).rdbuf();
+  return content.str();
+}
+
+bool check(bool condition, const std::string& what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+  }
+  return condition;
+}
+
+/**
+ * Runs the generator into output with the options, returns its exit status
+ */
+int generate(const std::string& generator, const std::string& output, const std::string& options) {
+  std::string command = "'" + generator + "' --output '" + output + "' " + options + " > /dev/null 2>&1";
+  int status = std::system(command.c_str());
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    std::cerr << "usage: FileManipulator_generate_test GENERATOR" << std::endl;
+    return 1;
+  }
+  const std::string generator = argv[1];
+  const char* temp = std::getenv("TMPDIR");
+  std::string directory = std::string(temp != nullptr && *temp != '\0' ? temp : "/tmp") + "/fm_generate_XXXXXX";
+  if (mkdtemp(&directory[0]) == nullptr) {
+    std::cerr << "FAILED: unable to create a temporary directory" << std::endl;
+    return 1;
+  }
+  // every option that draws random numbers
+  const std::string options = "--lines 5000 --columns 2-12 --field-length 0-40 --distribution skewed "
+                              "--empty-fields 0.1 --utf8 0.05 --long-lines 0.01 --long-field 5000";
+  const std::string first = directory + "/first.tsv";
+  const std::string second = directory + "/second.tsv";
+  const std::string other = directory + "/other.tsv";
+  bool ok = true;
+  ok &= check(generate(generator, first, "--seed 7 " + options) == 0, "first run");
+  ok &= check(generate(generator, second, "--seed 7 " + options) == 0, "second run");
+  ok &= check(generate(generator, other, "--seed 8 " + options) == 0, "other seed run");
+  const std::string content = read_file(first);
+  ok &= check(!content.empty(), "output written");
+  ok &= check(content == read_file(second), "same seed, same bytes");
+  ok &= check(content != read_file(other), "other seed, other bytes");
+  // bad values are refused before anything is written
+  const std::string refused = directory + "/refused.tsv";
+  for (const char* bad : {"--lines -5", "--lines abc", "--utf8 nan", "--empty-fields 2", "--columns 0"}) {
+    ok &= check(generate(generator, refused, bad) == 1, std::string("refused ") + bad);
+  }
+  ok &= check(access(refused.c_str(), F_OK) != 0, "nothing written for a refused option");
+  for (const std::string& path : {first, second, other}) {
+    unlink(path.c_str());
+    unlink((path + ".manifest.json").c_str());
+  }
+  rmdir(directory.c_str());
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,201 @@
+#include "filemanipulator.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * Rewriting files in place through run: written into the mapped file, or with
+ * atomic through a temporary file renamed over it that keeps the owner and
+ * the mode of the file and is not left behind, following symbolic links
+ */
+
+namespace {
+
+void write_file(const std::string& path, const std::string& content, mode_t mode) {
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << content;
+  chmod(path.c_str(), mode);
+}
+
+std::string read_file(const std::string& path) {
+  std::ostringstream content;
+  content << std::ifstream(path, std::ios::binary).rdbuf();
+  return content.str();
+}
+
+size_t count_entries(const std::string& directory) {
+  size_t count = 0;
+  DIR* dir = opendir(directory.c_str());
+  while (dirent* entry = readdir(dir)) {
+    count += std::string(entry->d_name) != "." && std::string(entry->d_name) != "..";
+  }
+  closedir(dir);
+  return count;
+}
+
+bool check(bool condition, const std::string& what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+  }
+  return condition;
+}
+
+std::string make_lines(size_t count) {
+  std::string lines;
+  for (size_t idx = 0; idx < count; ++idx) {
+    lines += "line\t" + std::to_string(idx) + "\t\tfield\n";
+  }
+  return lines;
+}
+
+std::string upper_lines(size_t count) {
+  std::string lines;
+  for (size_t idx = 0; idx < count; ++idx) {
+    lines += "line\t" + std::to_string(idx) + "\t\tFIELD\n";
+  }
+  return lines;
+}
+
+/**
+ * Rewrites a file of lines with the mode given and checks the content, the
+ * mode, the owner and the directory afterwards
+ */
+bool rewrite(const std::string& directory, bool atomic, unsigned jobs, size_t lines) {
+  const std::string path = directory + "/data.tsv";
+  const std::string what = std::string(atomic ? "atomic" : "mapped") + " -j " + std::to_string(jobs) + ": ";
+  write_file(path, make_lines(lines), 0640);
+  struct stat before{};
+  stat(path.c_str(), &before);
+
+  filemanipulator::Options options;
+  options.in_place = true;
+  options.atomic = atomic;
+  options.jobs = jobs;
+  bool ok = check(filemanipulator::run({path}, {"2:U"}, options) == 0, what + "exit status");
+
+  struct stat after{};
+  stat(path.c_str(), &after);
+  ok &= check(read_file(path) == upper_lines(lines), what + "content");
+  ok &= check((after.st_mode & 07777) == 0640, what + "mode");
+  ok &= check(after.st_uid == before.st_uid && after.st_gid == before.st_gid, what + "owner");
+  // the mapped file is written into, the atomic one is a new file
+  ok &= check((after.st_ino == before.st_ino) == !atomic, what + "inode");
+  ok &= check(count_entries(directory) == 1, what + "temporary file left");
+  unlink(path.c_str());
+  return ok;
+}
+
+/**
+ * A batch with a missing file reports it, rewrites the other file and
+ * returns 1, without leaving a temporary file behind
+ */
+bool rewrite_batch(const std::string& directory) {
+  const std::string path = directory + "/batch.tsv";
+  write_file(path, make_lines(3), 0600);
+  std::vector<std::string> errors;
+  filemanipulator::Options options;
+  options.in_place = true;
+  options.atomic = true;
+  options.jobs = 2;
+  options.on_error = [&errors](const std::string& message) { errors.push_back(message); };
+  bool ok = check(filemanipulator::run({directory + "/missing.tsv", path}, {"2:U"}, options) == 1,
+                  "batch: exit status");
+  ok &= check(errors.size() == 1, "batch: errors reported");
+  ok &= check(read_file(path) == upper_lines(3), "batch: content");
+  ok &= check(count_entries(directory) == 1, "batch: temporary file left");
+  unlink(path.c_str());
+  return ok;
+}
+
+/**
+ * Through a symbolic link the target is rewritten and the link kept, and a
+ * file with another hard link is refused rather than split in two
+ */
+bool rewrite_links(const std::string& directory) {
+  const std::string path = directory + "/target.tsv";
+  const std::string link = directory + "/link.tsv";
+  write_file(path, make_lines(3), 0640);
+  symlink("target.tsv", link.c_str());
+  filemanipulator::Options options;
+  options.in_place = true;
+  options.atomic = true;
+  bool ok = check(filemanipulator::run({link}, {"2:U"}, options) == 0, "symbolic link: exit status");
+  struct stat st{};
+  ok &= check(lstat(link.c_str(), &st) == 0 && S_ISLNK(st.st_mode), "symbolic link: kept");
+  ok &= check(read_file(path) == upper_lines(3), "symbolic link: target content");
+  ok &= check(stat(path.c_str(), &st) == 0 && (st.st_mode & 07777) == 0640, "symbolic link: target mode");
+  unlink(link.c_str());
+
+  const std::string other = directory + "/other.tsv";
+  write_file(path, make_lines(3), 0640);
+  ::link(path.c_str(), other.c_str());
+  bool refused = false;
+  try {
+    filemanipulator::run({path}, {"2:U"}, options);
+  } catch (const std::runtime_error&) {
+    refused = true;
+  }
+  ok &= check(refused, "hard link: refused");
+  ok &= check(read_file(other) == make_lines(3), "hard link: content kept");
+  ok &= check(count_entries(directory) == 2, "hard link: temporary file left");
+  unlink(other.c_str());
+  unlink(path.c_str());
+  return ok;
+}
+
+/**
+ * Options that can not divide the work are refused before the file is touched
+ */
+bool refuse_options(const std::string& directory) {
+  const std::string path = directory + "/options.tsv";
+  write_file(path, make_lines(3), 0640);
+  bool ok = true;
+  for (int idx = 0; idx < 2; ++idx) {
+    filemanipulator::Options options;
+    options.in_place = true;
+    if (idx == 0) {
+      options.jobs = 0;
+    } else {
+      options.max_open = 0;
+    }
+    bool refused = false;
+    try {
+      filemanipulator::run({path, path}, {"2:U"}, options);
+    } catch (const std::invalid_argument&) {
+      refused = true;
+    }
+    ok &= check(refused, idx == 0 ? "jobs 0: refused" : "max_open 0: refused");
+  }
+  ok &= check(read_file(path) == make_lines(3), "bad options: content kept");
+  unlink(path.c_str());
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  const char* temp = std::getenv("TMPDIR");
+  std::string directory = std::string(temp != nullptr && *temp != '\0' ? temp : "/tmp") + "/fm_inplace_XXXXXX";
+  if (mkdtemp(&directory[0]) == nullptr) {
+    std::cerr << "FAILED: unable to create a temporary directory" << std::endl;
+    return 1;
+  }
+  bool ok = true;
+  ok &= rewrite(directory, false, 1, 10);
+  ok &= rewrite(directory, true, 1, 10);
+  ok &= rewrite(directory, false, 3, 200000);
+  ok &= rewrite(directory, true, 3, 200000);
+  ok &= rewrite_batch(directory);
+  ok &= rewrite_links(directory);
+  ok &= refuse_options(directory);
+  rmdir(directory.c_str());
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+#include "filemanipulator.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Which lines are printed and how, through the streaming API: a line is
+ * printed when a command changed one of its fields, commands on fields the
+ * line does not have are ignored, and empty fields are dropped from the
+ * printed line wherever they are, however far the line had to be split
+ */
+
+namespace {
+
+std::string transform(const std::string& input, const std::vector<std::string>& commands, bool all_lines = false) {
+  filemanipulator::Transformer transformer(commands, all_lines);
+  std::string output;
+  auto sink = [&output](std::string_view bytes) { output.append(bytes); };
+  transformer.push(input, sink);
+  transformer.finish(sink);
+  return output;
+}
+
+bool expect(const std::string& input, const std::vector<std::string>& commands, const std::string& expected,
+            bool all_lines = false) {
+  std::string output = transform(input, commands, all_lines);
+  if (output == expected) {
+    return true;
+  }
+  std::cerr << "FAILED: [";
+  for (const std::string& command : commands) {
+    std::cerr << ' ' << command;
+  }
+  std::cerr << " ] on \"" << input << "\": \"" << output << "\", expected \"" << expected << '"' << std::endl;
+  return false;
+}
+
+}  // namespace
+
+int main() {
+  bool ok = true;
+  // a line shorter than the referenced field is not printed
+  ok &= expect("ab\tcd\n", {"3:U"}, "");
+  ok &= expect("ab\n\tcd\n", {"1:U"}, "");
+  // the fields it has are changed, the missing ones ignored
+  ok &= expect("ab\tcd\n", {"0:U", "3:u"}, "AB\tcd\n");
+  ok &= expect("ab\ncd\tef\n", {"1:U"}, "cd\tEF\n");
+  // a line that the commands leave as it is is not printed
+  ok &= expect("ab\tcd\n", {"0:u", "1:Rxy"}, "");
+  // lower case on upper case bytes, only the field referenced
+  ok &= expect("AbC\tDE\n", {"0:u"}, "abc\tDE\n");
+  // replace writes the target byte, every pair applies to the original
+  // bytes so two pairs can swap, and the first pair of a byte wins
+  ok &= expect("abca\tx\n", {"0:Rab"}, "bbcb\tx\n");
+  ok &= expect("abba\tx\n", {"0:Rabba"}, "baab\tx\n");
+  ok &= expect("abc\tx\n", {"0:Rabac"}, "bbc\tx\n");
+  ok &= expect("xyz\ta\n", {"0:Rab"}, "");
+  // empty fields are skipped when fields are counted and dropped from the
+  // output, before and after the last referenced field alike
+  ok &= expect("\tab\t\tcd\t\t\tef\t\n", {"1:U"}, "ab\tCD\tef\n");
+  ok &= expect("\tab\t\tcd\t\t\tef\t\n", {"0:U"}, "AB\tcd\tef\n");
+  ok &= expect("\tab\t\tcd\t\t\tef\t\n", {"2:U"}, "ab\tcd\tEF\n");
+  ok &= expect("ab\tcd\tef\t\n", {"0:U"}, "AB\tcd\tef\n");
+  ok &= expect("ab\tcd\t\t\n", {"0:U"}, "AB\tcd\n");
+  // a last line without new line
+  ok &= expect("ab\tcd", {"0:U"}, "AB\tcd\n");
+  // all_lines keeps every line and every empty field as they were
+  ok &= expect("\tab\t\tcd\t\t\tef\t\nx\n", {"1:U"}, "\tab\t\tCD\t\t\tef\t\nx\n", true);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#include "filemanipulator.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * run over a file of several 4 MiB chunks gives the same bytes whatever the
+ * way it is read and the number of threads: mapped with jobs threads, or read
+ * on a reader thread with read(2) or io_uring, compared with one thread
+ * transforming the mapped file and with the streaming API
+ */
+
+namespace {
+
+std::string read_file(const std::string& path) {
+  std::ostringstream content;
+  content << std::ifstream(path, std::ios::binary).rdbuf();
+  return content.str();
+}
+
+bool check(bool condition, const std::string& what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+  }
+  return condition;
+}
+
+/**
+ * Lines of mixed case fields, some with empty fields or unchanged, a line
+ * longer than a chunk in the middle and a last line without new line
+ */
+std::string make_input(size_t lines) {
+  std::string input;
+  for (size_t idx = 0; idx < lines; ++idx) {
+    if (idx == lines / 2) {
+      input += std::string(5 << 20, 'a') + "\tLong\n";
+    }
+    input += "Line" + std::to_string(idx);
+    input += idx % 3 == 0 ? "\t\t" : "\t";
+    input += idx % 5 == 0 ? "ABC" : "abc";
+    input += "\tbanana" + std::to_string(idx % 7) + (idx % 11 == 0 ? "\t\n" : "\n");
+  }
+  input += "last\tline";
+  return input;
+}
+
+/**
+ * What the library gives for input through the streaming API
+ */
+std::string expected(const std::string& input, const std::vector<std::string>& commands, bool all_lines) {
+  filemanipulator::Transformer transformer(commands, all_lines);
+  std::string output;
+  auto sink = [&output](std::string_view bytes) { output.append(bytes); };
+  transformer.push(input, sink);
+  transformer.finish(sink);
+  return output;
+}
+
+/**
+ * Runs over path with the standard output redirected into output_path and
+ * returns what was written, or a string starting with "run failed" if run
+ * did not return 0
+ */
+std::string run_to_file(const std::string& path, const std::string& output_path,
+                        const std::vector<std::string>& commands, const filemanipulator::Options& options) {
+  int output_fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  int saved = dup(STDOUT_FILENO);
+  dup2(output_fd, STDOUT_FILENO);
+  close(output_fd);
+  int status = filemanipulator::run({path}, commands, options);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  std::string output = read_file(output_path);
+  unlink(output_path.c_str());
+  return status == 0 ? output : "run failed with " + std::to_string(status);
+}
+
+}  // namespace
+
+int main() {
+  const char* temp = std::getenv("TMPDIR");
+  std::string directory = std::string(temp != nullptr && *temp != '\0' ? temp : "/tmp") + "/fm_parallel_XXXXXX";
+  if (mkdtemp(&directory[0]) == nullptr) {
+    std::cerr << "FAILED: unable to create a temporary directory" << std::endl;
+    return 1;
+  }
+  const std::string path = directory + "/data.tsv";
+  const std::string output_path = directory + "/output.tsv";
+  const std::string input = make_input(400000);
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << input;
+  const std::vector<std::string> commands = {"0:u", "1:U", "2:Rab"};
+
+  bool ok = check(input.size() > (12 << 20), "input of several chunks");
+  for (bool all_lines : {false, true}) {
+    const std::string mode = all_lines ? "all lines, " : "";
+    filemanipulator::Options options;
+    options.all_lines = all_lines;
+    const std::string sequential = run_to_file(path, output_path, commands, options);
+    ok &= check(sequential == expected(input, commands, all_lines), mode + "sequential");
+    for (unsigned jobs : {1u, 2u, 4u}) {
+      for (int reader = 0; reader < 3; ++reader) {
+        // jobs 1 mapped is the sequential run itself
+        if (jobs == 1 && reader == 0) {
+          continue;
+        }
+        options.jobs = jobs;
+        options.pipeline = reader > 0;
+        options.io_uring = reader == 2;
+        const char* name = reader == 0 ? "mapped" : reader == 1 ? "pipeline" : "pipeline io_uring";
+        ok &= check(run_to_file(path, output_path, commands, options) == sequential,
+                    mode + name + " -j " + std::to_string(jobs));
+      }
+    }
+  }
+  unlink(path.c_str());
+  rmdir(directory.c_str());
+  return ok ? 0 : 1;
+}
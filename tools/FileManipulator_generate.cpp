@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+/**
+ * =============================================================================
+ * Random numbers
+ * =============================================================================
+ */
+
+/**
+ * splitmix64, small and fully specified, so that a seed produces the same file
+ * with any compiler and standard library (std:: distributions do not guarantee that)
+ */
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+  uint64_t next() {
+    uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+  /**
+   * Uniform in [min, max]
+   */
+  uint64_t between(uint64_t min, uint64_t max) {
+    return min + next() % (max - min + 1);
+  }
+  /**
+   * Uniform in [0, 1)
+   */
+  double unit() {
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+  }
+  bool chance(double probability) {
+    return unit() < probability;
+  }
+ private:
+  uint64_t state_;
+};
+
+/**
+ * =============================================================================
+ * End Random numbers
+ * =============================================================================
+ */
+
+/**
+ * Generation parameters, all of them are recorded in the manifest
+ */
+struct Options {
+  uint64_t seed = 1;
+  uint64_t lines = 100000;
+  uint64_t min_columns = 8;
+  uint64_t max_columns = 8;
+  uint64_t min_field = 1;
+  uint64_t max_field = 16;
+  // uniform or skewed (most fields short, few long)
+  std::string distribution = "uniform";
+  double empty_fields = 0.0;
+  double utf8 = 0.0;
+  double long_lines = 0.0;
+  uint64_t long_field = 1 << 20;
+  std::string output;
+  std::string manifest;
+};
+
+/**
+ * What was actually generated
+ */
+struct Stats {
+  uint64_t bytes = 0;
+  uint64_t lines = 0;
+  uint64_t fields = 0;
+  uint64_t empty_fields = 0;
+  uint64_t utf8_chars = 0;
+  uint64_t long_lines = 0;
+  uint64_t max_line = 0;
+};
+
+void print_help_and_exit() {
+  std::string help_line = R"(
+  FileManipulator_generate writes a reproducible synthetic TSV file and a
+  manifest describing it
+  --output FILE           - file to write, required
+  --manifest FILE         - manifest to write, FILE.manifest.json by default
+  --seed N                - seed, the same seed and options give the same file
+  --lines N               - number of lines
+  --columns N[-M]         - fields per line, uniform between N and M
+  --field-length N-M      - field length in characters
+  --distribution D        - field lengths: uniform or skewed (mostly short)
+  --empty-fields P        - probability of a field being empty
+  --utf8 P                - probability of a character being 2-byte UTF-8
+  --long-lines P          - probability of a line having one very long field
+  --long-field N          - length of that field
+)";
+
+  std::cout << help_line;
+  std::exit(1);
+}
+
+void print_value_error_and_exit(const std::string& option, const std::string& value, const char* expected) {
+  std::cerr << "Warning: unable to parse option [" << option << ' ' << value << "], expected " << expected << std::endl;
+  print_help_and_exit();
+}
+
+/**
+ * Parses a count, digits only: stoull would take a sign and wrap "-5"
+ */
+uint64_t parse_count(const std::string& option, const std::string& value) {
+  if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos) {
+    print_value_error_and_exit(option, value, "a number");
+  }
+  try {
+    return std::stoull(value);
+  } catch (const std::out_of_range&) {
+    print_value_error_and_exit(option, value, "a smaller number");
+  }
+  return 0;
+}
+
+/**
+ * Parses a probability, NaN and anything outside [0, 1] included are refused
+ */
+double parse_probability(const std::string& option, const std::string& value) {
+  char* end = nullptr;
+  double probability = std::strtod(value.c_str(), &end);
+  if (value.empty() || *end != '\0' || !(probability >= 0.0 && probability <= 1.0)) {
+    print_value_error_and_exit(option, value, "a probability from 0 to 1");
+  }
+  return probability;
+}
+
+/**
+ * Parses N or N-M into min and max
+ */
+void parse_range(const std::string& option, const std::string& value, uint64_t& min, uint64_t& max) {
+  size_t dash = value.find('-');
+  min = parse_count(option, value.substr(0, dash));
+  max = dash == std::string::npos ? min : parse_count(option, value.substr(dash + 1));
+  if (max < min) {
+    print_value_error_and_exit(option, value, "N or N-M with N <= M");
+  }
+}
+
+void parse_options(int argc, char* const* argv, Options& options) {
+  for (int idx = 1; idx < argc; ++idx) {
+    std::string option(argv[idx]);
+    if (idx + 1 >= argc) {
+      std::cerr << "Warning: missing value for [" << option << "]" << std::endl;
+      print_help_and_exit();
+    }
+    std::string value(argv[++idx]);
+    if (option == "--output") {
+      options.output = value;
+    } else if (option == "--manifest") {
+      options.manifest = value;
+    } else if (option == "--seed") {
+      options.seed = parse_count(option, value);
+    } else if (option == "--lines") {
+      options.lines = parse_count(option, value);
+    } else if (option == "--columns") {
+      parse_range(option, value, options.min_columns, options.max_columns);
+      // a line has at least one field, the long one among others
+      if (options.min_columns == 0) {
+        print_value_error_and_exit(option, value, "at least 1 column");
+      }
+    } else if (option == "--field-length") {
+      parse_range(option, value, options.min_field, options.max_field);
+    } else if (option == "--distribution" && (value == "uniform" || value == "skewed")) {
+      options.distribution = value;
+    } else if (option == "--empty-fields") {
+      options.empty_fields = parse_probability(option, value);
+    } else if (option == "--utf8") {
+      options.utf8 = parse_probability(option, value);
+    } else if (option == "--long-lines") {
+      options.long_lines = parse_probability(option, value);
+    } else if (option == "--long-field") {
+      options.long_field = parse_count(option, value);
+    } else {
+      std::cerr << "Warning: unable to parse option [" << option << "]" << std::endl;
+      print_help_and_exit();
+    }
+  }
+  if (options.output.empty()) {
+    print_help_and_exit();
+  }
+  if (options.manifest.empty()) {
+    options.manifest = options.output + ".manifest.json";
+  }
+}
+
+/**
+ * =============================================================================
+ * Generation
+ * =============================================================================
+ */
+
+uint64_t field_length(const Options& options, Random& random) {
+  if (options.distribution == "skewed") {
+    // the minimum of three draws, most fields end up close to min_field
+    uint64_t length = options.max_field;
+    for (int draw = 0; draw < 3; ++draw) {
+      length = std::min(length, random.between(options.min_field, options.max_field));
+    }
+    return length;
+  }
+  return random.between(options.min_field, options.max_field);
+}
+
+/**
+ * Appends length characters: ASCII letters, digits and spaces, and with the
+ * utf8 probability Cyrillic letters (two bytes each, counted as one character)
+ */
+void append_field(std::string& out, uint64_t length, const Options& options, Random& random, Stats& stats) {
+  static const char ascii[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ";
+  for (uint64_t idx = 0; idx < length; ++idx) {
+    if (options.utf8 > 0 && random.chance(options.utf8)) {
+      // U+0410..U+044F
+      unsigned code = 0x410 + random.between(0, 0x3F);
+      out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+      out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+      ++stats.utf8_chars;
+    } else {
+      out.push_back(ascii[random.between(0, sizeof(ascii) - 2)]);
+    }
+  }
+}
+
+void generate(const Options& options, std::FILE* file, Stats& stats) {
+  Random random(options.seed);
+  std::string buffer;
+  std::string line;
+  for (uint64_t line_idx = 0; line_idx < options.lines; ++line_idx) {
+    line.clear();
+    uint64_t columns = random.between(options.min_columns, options.max_columns);
+    bool long_line = options.long_lines > 0 && random.chance(options.long_lines);
+    uint64_t long_column = long_line ? random.between(0, columns - 1) : columns;
+    for (uint64_t column = 0; column < columns; ++column) {
+      if (column != 0) {
+        line.push_back('\t');
+      }
+      uint64_t length = column == long_column ? options.long_field : field_length(options, random);
+      if (column != long_column && options.empty_fields > 0 && random.chance(options.empty_fields)) {
+        length = 0;
+      }
+      stats.empty_fields += length == 0;
+      append_field(line, length, options, random, stats);
+    }
+    line.push_back('\n');
+    stats.fields += columns;
+    stats.long_lines += long_line;
+    stats.max_line = std::max<uint64_t>(stats.max_line, line.size() - 1);
+    buffer += line;
+    if (buffer.size() >= (1 << 20)) {
+      stats.bytes += std::fwrite(buffer.data(), 1, buffer.size(), file);
+      buffer.clear();
+    }
+  }
+  stats.bytes += std::fwrite(buffer.data(), 1, buffer.size(), file);
+  stats.lines = options.lines;
+}
+
+/**
+ * Quotes value as a JSON string, escaping quotes, backslashes and control characters
+ */
+std::string json_string(const std::string& value) {
+  std::string quoted = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      quoted.push_back('\\');
+      quoted.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+      quoted += escaped;
+    } else {
+      quoted.push_back(c);
+    }
+  }
+  quoted.push_back('"');
+  return quoted;
+}
+
+void write_manifest(const Options& options, const Stats& stats) {
+  std::FILE* file = std::fopen(options.manifest.c_str(), "w");
+  if (file == nullptr) {
+    std::cerr << "Error: unable to open file [" << options.manifest << "]" << std::endl;
+    std::exit(1);
+  }
+  std::fprintf(file,
+      "{\n"
+      "  \"file\": %s,\n"
+      "  \"options\": {\n"
+      "    \"seed\": %llu,\n"
+      "    \"lines\": %llu,\n"
+      "    \"columns\": [%llu, %llu],\n"
+      "    \"field_length\": [%llu, %llu],\n"
+      "    \"distribution\": \"%s\",\n"
+      "    \"empty_fields\": %g,\n"
+      "    \"utf8\": %g,\n"
+      "    \"long_lines\": %g,\n"
+      "    \"long_field\": %llu\n"
+      "  },\n"
+      "  \"stats\": {\n"
+      "    \"bytes\": %llu,\n"
+      "    \"lines\": %llu,\n"
+      "    \"fields\": %llu,\n"
+      "    \"empty_fields\": %llu,\n"
+      "    \"utf8_chars\": %llu,\n"
+      "    \"long_lines\": %llu,\n"
+      "    \"max_line_bytes\": %llu\n"
+      "  }\n"
+      "}\n",
+      json_string(options.output).c_str(),
+      (unsigned long long) options.seed, (unsigned long long) options.lines,
+      (unsigned long long) options.min_columns, (unsigned long long) options.max_columns,
+      (unsigned long long) options.min_field, (unsigned long long) options.max_field,
+      options.distribution.c_str(), options.empty_fields, options.utf8, options.long_lines,
+      (unsigned long long) options.long_field,
+      (unsigned long long) stats.bytes, (unsigned long long) stats.lines,
+      (unsigned long long) stats.fields, (unsigned long long) stats.empty_fields,
+      (unsigned long long) stats.utf8_chars, (unsigned long long) stats.long_lines,
+      (unsigned long long) stats.max_line);
+  std::fclose(file);
+}
+
+/**
+ * =============================================================================
+ * End Generation
+ * =============================================================================
+ */
+
+int main(int argc, char** argv) {
+  Options options;
+  parse_options(argc, argv, options);
+
+  std::FILE* file = std::fopen(options.output.c_str(), "wb");
+  if (file == nullptr) {
+    std::cerr << "Error: unable to open file [" << options.output << "]" << std::endl;
+    std::exit(1);
+  }
+  Stats stats;
+  generate(options, file, stats);
+  if (std::fclose(file) != 0) {
+    std::cerr << "Error: unable to write file [" << options.output << "]" << std::endl;
+    std::exit(1);
+  }
+  write_manifest(options, stats);
+
+  return 0;
+}